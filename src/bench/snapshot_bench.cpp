@@ -0,0 +1,136 @@
+#include "fireball/scene/serializer.h"
+
+#include <flecs.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// full snapshot benchmark
+// builds a world shaped like a real scene, roots with two levels of
+// children, and times serialize_scene and serialize_scene_chunked on it.
+// fails if the median full snapshot takes longer than the budget
+
+using Clock = std::chrono::steady_clock;
+
+struct Bench_Settings {
+    uint32_t entities = 100000;
+    uint32_t iterations = 50;
+    uint32_t chunk_size = 16 * 1024;
+    double budget_ms = 5.0;
+};
+
+// every tree is a root, 3 children and 2 grandchildren per child
+static constexpr uint32_t TREE_SIZE = 10;
+
+static void populate(flecs::world& world, uint32_t count) {
+    uint32_t created = 0;
+
+    auto make = [&](flecs::entity parent) {
+        flecs::entity e = world.entity();
+        if (parent)
+            e.child_of(parent);
+
+        Transform_Component t;
+        t.position = vec3(float(created % 1000), float(created % 7), float(created / 1000 % 1000));
+        t.rotation = vec3(0.0f, float(created % 360) * 0.0174533f, 0.0f);
+        e.set<Transform_Component>(t);
+        e.set<Name_Component>({ "entity_" + std::to_string(created) });
+
+        if (created % 4 == 0)
+            e.set<Server_Model_Component>({ "cube.obj" });
+        if (created % 16 == 0)
+            e.set<Light_Component>({});
+
+        created++;
+        return e;
+    };
+
+    while (created < count) {
+        flecs::entity root = make(flecs::entity());
+        for (uint32_t i = 0; i < 3 && created < count; i++) {
+            flecs::entity child = make(root);
+            for (uint32_t j = 0; j < 2 && created < count; j++)
+                make(child);
+        }
+    }
+}
+
+struct Timings {
+    double min_ms;
+    double p50_ms;
+    double max_ms;
+};
+
+template<typename F>
+static Timings measure(uint32_t iterations, F&& f) {
+    std::vector<double> ms;
+    ms.reserve(iterations);
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        Clock::time_point start = Clock::now();
+        f();
+        ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+
+    std::sort(ms.begin(), ms.end());
+    return { ms.front(), ms[ms.size() / 2], ms.back() };
+}
+
+static void print_usage() {
+    printf("snapshot_bench [--entities 100000] [--iterations 50] [--chunk-size 16384] [--budget 5]\n");
+}
+
+int main(int argc, char** argv) {
+    Bench_Settings settings;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--entities") == 0 && has_value)         settings.entities = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+        else if (strcmp(argv[i], "--iterations") == 0 && has_value)  settings.iterations = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+        else if (strcmp(argv[i], "--chunk-size") == 0 && has_value)  settings.chunk_size = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+        else if (strcmp(argv[i], "--budget") == 0 && has_value)      settings.budget_ms = atof(argv[++i]);
+        else {
+            print_usage();
+            return 2;
+        }
+    }
+
+    flecs::world world;
+    populate(world, settings.entities);
+
+    Snapshot_Writer writer(world);
+
+    // warm up, the arena grows to its final size here
+    size_t bytes = serialize_scene(writer).size();
+    uint32_t written = 0;
+    memcpy(&written, writer.arena.data.data(), sizeof(written));
+    if (written != settings.entities) {
+        printf("[BENCH] FAIL, wrote %u of %u entities\n", written, settings.entities);
+        return 1;
+    }
+
+    Timings full = measure(settings.iterations, [&]() {
+        serialize_scene(writer);
+    });
+
+    uint32_t chunks = 0;
+    Timings chunked = measure(settings.iterations, [&]() {
+        Snapshot_Stream stream = serialize_scene_chunked(writer, nullptr, settings.chunk_size);
+        chunks = stream.manifest.chunk_count;
+        release_chunks(stream);
+    });
+
+    printf("[BENCH] %u entities, %zu bytes (%.1f per entity)\n", settings.entities, bytes, double(bytes) / settings.entities);
+    printf("  full      min %8.3f  p50 %8.3f  max %8.3f ms\n", full.min_ms, full.p50_ms, full.max_ms);
+    printf("  chunked   min %8.3f  p50 %8.3f  max %8.3f ms, %u chunks\n", chunked.min_ms, chunked.p50_ms, chunked.max_ms, chunks);
+
+    bool pass = full.p50_ms <= settings.budget_ms;
+    printf("[BENCH] %s, full snapshot p50 %.3f ms of %.3f ms budget\n", pass ? "PASS" : "FAIL", full.p50_ms, settings.budget_ms);
+    return pass ? 0 : 1;
+}
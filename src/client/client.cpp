@@ -3,18 +3,23 @@
 #include "fireball/camera.h"
 #include "fireball/asset/model_manager.h"
 #include "fireball/asset/texture_manager.h"
+#include "fireball/core/jobs.h"
 #include "fireball/core/physics.h"
 #include "fireball/networking/client.h"
 #include "fireball/renderer/vk_backend.h"
+#include "fireball/scene/asset_manifest.h"
 #include "fireball/scene/components.h"
+#include "fireball/scene/movement.h"
 #include "fireball/scene/serializer.h"
 #include "fireball/scene/scene.h"
+#include "fireball/scene/snapshot.h"
 #include "fireball/util/math.h"
 
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_vulkan.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdint>
 #include <span>
@@ -93,6 +98,7 @@ int main() {
 		return 1;
 	}
 
+	Jobs::init();
 	Texture_Manager::init(&renderer);
 	Model_Manager::init("../resources/models/");
 	Physics::init();
@@ -108,7 +114,7 @@ int main() {
 	renderer.upload_geometry(Model_Manager::get_indices(), Model_Manager::get_vertices());
 
 	// create entities from list that server has
-	std::unordered_map<uint64_t, Entity> id_map;
+	Net_Id_Map id_map;
 	
 	Camera camera;
 	Client client;
@@ -116,6 +122,87 @@ int main() {
 		deserialize_scene(scene, data, bytes, id_map);
     };
 
+	// streamed full snapshot, applied chunk by chunk and shown on the loading screen.
+	// also kept as the baseline of the first delta
+	Snapshot_Receiver snapshot_receiver;
+	Snapshot_Manifest load_manifest = {};
+	bool manifest_received = false;
+	bool stream_valid = false;
+	uint32_t loaded_bytes = 0;
+	uint32_t loaded_chunks = 0;
+	std::vector<Asset_Manifest_Entry> load_assets;
+	client.on_snapshot_manifest = [&](const Snapshot_Manifest& manifest, std::span<const uint8_t> assets) {
+		// loads start here, before any chunk creates an entity that needs them
+		ByteReader r(assets.data(), assets.size());
+		if (!assets.empty() && deserialize_asset_manifest(r, load_assets))
+			prefetch_assets(load_assets);
+
+		load_manifest = manifest;
+		manifest_received = true;
+		loaded_bytes = 0;
+		loaded_chunks = 0;
+
+		begin_stream_snapshot(snapshot_receiver.ring, manifest);
+		stream_valid = true;
+	};
+	client.on_snapshot_chunk = [&](const uint8_t* data, size_t bytes) {
+		if (!deserialize_scene_chunk(scene, data, bytes, id_map))
+			printf("[CLIENT] Malformed snapshot chunk %u\n", loaded_chunks);
+
+		// a broken chunk leaves the stream without baseline, the server gives up on it after a while
+		bool last = loaded_chunks + 1 >= load_manifest.chunk_count;
+		stream_valid = stream_valid && read_stream_chunk(snapshot_receiver.ring, load_manifest, data, bytes, last);
+
+		loaded_bytes += static_cast<uint32_t>(bytes);
+		loaded_chunks++;
+	};
+
+	client.on_delta = [&](const uint8_t* data, size_t bytes) {
+		return apply_delta(scene, data, bytes, glfwGetTime(), snapshot_receiver, id_map);
+	};
+	client.on_accepted = [&](const Client_Accepted& info) {
+		snapshot_receiver.clock.tick_interval = 1.0 / std::max(info.tick_rate, 1u);
+	};
+	client.on_entities_destroyed = [&](const uint8_t* data, size_t bytes) {
+		destroy_entities(scene, data, bytes, snapshot_receiver, id_map);
+	};
+
+	double viewpoint_timer = 0.0;
+	const double viewpoint_interval = 1.0 / 20.0;
+
+	// local player prediction, inputs run at the server tick rate
+	Input_Predictor predictor;
+	Entity local_player;
+	double input_accumulator = 0.0;
+
+	client.on_input_ack = [&](const Input_Ack& ack) {
+		Entity e = id_map.find(ack.entity_id);
+		if (!e) return;
+
+		if (local_player != e) {
+			local_player = e;
+			local_player.add<Predicted_Component>();
+			local_player.remove<Interpolation_Component>();
+		}
+
+		predictor.reconcile(ack, static_cast<float>(snapshot_receiver.clock.tick_interval));
+	};
+
+	// nothing of a previous server carries over into the next join
+	auto reset_client_session = [&]() {
+		reset_session(scene, snapshot_receiver, id_map);
+		predictor = Input_Predictor();
+		local_player = Entity();
+		input_accumulator = 0.0;
+
+		load_manifest = {};
+		manifest_received = false;
+		stream_valid = false;
+		loaded_bytes = 0;
+		loaded_chunks = 0;
+		load_assets.clear();
+	};
+
 	double dt;
 	double last_frame = 0.0;
 	uint32_t fps_frames = 0;
@@ -177,10 +264,10 @@ int main() {
 
 		static char ip_buffer[64] = "127.0.0.1";
 		static int port = 5678;
-		static float fake_loading_progress = 0.0f;
 		static char name[16] = "client";
 
 		client.tick();
+		scene.world.set<Interpolation_Time>({ snapshot_receiver.clock.render_time(glfwGetTime()), snapshot_receiver.clock.max_extrapolation });
 		// check data from client to set game state
 
 		if (game_state == Game_State::MainMenu) {
@@ -197,12 +284,10 @@ int main() {
 			ImGui::InputText("Name", name, IM_ARRAYSIZE(name));
 
 			if (ImGui::Button("Connect")) {
-				// read network
-				fake_loading_progress = 0.0f;
+				reset_client_session();
+				client.send_viewpoint(camera.position.x, camera.position.y, camera.position.z);
 				client.connect(ip_buffer, port, name);
-				// try to connect to server
-				// set state to Connecting
-				game_state = Game_State::Playing;
+				game_state = Game_State::Loading;
 			}
 
 			ImGui::SameLine();
@@ -215,16 +300,11 @@ int main() {
 			renderer.draw_blank(vec4(0.4f, 0.7f, 0.2f, 1.0f));
 		}
 		else if (game_state == Game_State::Loading) {
-			// poll server
-			// parse data
-			// do what's needed with said data
-			// update display / log
-			// if done loading change state 
-
-			fake_loading_progress += 0.005f;
-			if (fake_loading_progress >= 1.0f) {
-				fake_loading_progress = 1.0f;
-				game_state = Game_State::Playing;
+			float loading_progress = 0.0f;
+			if (manifest_received) {
+				loading_progress = load_manifest.total_bytes ? static_cast<float>(loaded_bytes) / load_manifest.total_bytes : 1.0f;
+				if (loaded_chunks >= load_manifest.chunk_count)
+					game_state = Game_State::Playing;
 			}
 
 			ImGui::Begin("Loading...", nullptr,
@@ -232,18 +312,60 @@ int main() {
 				ImGuiWindowFlags_NoCollapse |
 				ImGuiWindowFlags_AlwaysAutoResize);
 
-			ImGui::Text("Connecting to server...");
-			ImGui::ProgressBar(fake_loading_progress, ImVec2(300, 0));
+			if (manifest_received)
+				ImGui::Text("Loading world, %u / %u KB", loaded_bytes / 1024, load_manifest.total_bytes / 1024);
+			else
+				ImGui::Text("Connecting to server...");
+			ImGui::ProgressBar(loading_progress, ImVec2(300, 0));
 
-			if (ImGui::Button("Cancel"))
+			if (ImGui::Button("Cancel")) {
+				client.disconnect();
+				reset_client_session();
 				game_state = Game_State::MainMenu;
+			}
 
 			ImGui::End();
 
 			renderer.draw_blank(vec4(0.4f, 0.2f, 0.7f, 1.0f));
 		}
 		else if (game_state == Game_State::Playing) {
-			fake_loading_progress = 0.0f;
+			viewpoint_timer += dt;
+			if (viewpoint_timer >= viewpoint_interval) {
+				viewpoint_timer = 0.0;
+				client.send_viewpoint(camera.position.x, camera.position.y, camera.position.z);
+			}
+
+			const double input_dt = snapshot_receiver.clock.tick_interval;
+			input_accumulator = std::min(input_accumulator + dt, input_dt * 8);
+			while (input_accumulator >= input_dt) {
+				input_accumulator -= input_dt;
+
+				auto axis = [&](int neg, int pos) {
+					return static_cast<int8_t>((glfwGetKey(window, pos) == GLFW_PRESS ? 127 : 0) - (glfwGetKey(window, neg) == GLFW_PRESS ? 127 : 0));
+				};
+
+				Input_Command input {
+					.move_x = axis(GLFW_KEY_LEFT, GLFW_KEY_RIGHT),
+					.move_z = axis(GLFW_KEY_DOWN, GLFW_KEY_UP),
+					.buttons = static_cast<uint8_t>(glfwGetKey(window, GLFW_KEY_RIGHT_CONTROL) == GLFW_PRESS ? Input_Jump : 0),
+					.yaw = radians(camera.yaw),
+				};
+				predictor.record(input, static_cast<float>(input_dt));
+			}
+
+			if (predictor.has_pending()) {
+				Client_Input packet;
+				predictor.fill_packet(packet);
+				client.send_input(packet);
+			}
+
+			if (local_player && local_player.is_alive()) {
+				Transform_Component& t = local_player.get_mut<Transform_Component>();
+				t.position = predictor.state.position;
+				t.rotation = movement_rotation(predictor.state);
+				t.dirty = true;
+				renderer.debug_renderer.add_point(t.position, vec4(0.2f, 1.0f, 0.2f, 1.0f));
+			}
 
 		// TODO stuff code in some corner
 		scene.world.query<Light_Component>()
@@ -349,7 +471,7 @@ int main() {
 			// if tick send update, or just send, tbd
 			// if disconnect send message and cleanup for main menu
 
-			Physics::update();
+			Physics::step(static_cast<float>(dt));
 
 			if (g_spawn_requested) {
 				g_spawn_requested = false;
@@ -381,6 +503,7 @@ int main() {
 
 	renderer.cleanup();
 	// Physics::shutdown(); // ??
+	Jobs::shutdown();
 
 	glfwDestroyWindow(window);
 	glfwTerminate();
@@ -1,38 +1,69 @@
 #include "fireball/scene/scene.h"
 
+#include "fireball/asset/model_manager.h"
+#include "fireball/core/jobs.h"
 #include "fireball/scene/components.h"
 
+#include <algorithm>
+
 #ifdef FIREBALL_CLIENT
 #include "fireball/renderer/vk_backend.h"
+#include "fireball/scene/interpolation.h"
 #include <imgui.h>
 #endif
 
 Scene::Scene(Vk_Backend* _renderer) {
     renderer = _renderer;
 
-    world.system<Physics_Component>()
-    .kind(flecs::OnUpdate)
-    .each([this](Entity e, Physics_Component& pc) {
-        Transform_Component& tc = e.get_mut<Transform_Component>();
-        tc.position = Physics::get_pos(pc.handle);
-        tc.rotation = Physics::get_rot(pc.handle);
-        tc.dirty = true;
-
-        // printf("id %lu pos %f %f %f\n", e.id(), tc.position.x, tc.position.y, tc.position.z);
-    });
-
     world.observer<Physics_Component>()
     .event(flecs::OnSet)
     .each([this](Entity e, const Physics_Component& pc) {
         // TODO if physics info changes remove body and readd with. Can either use new info or stuff from current info
+        if (pc.handle.IsInvalid())
+            m_pending_bodies.push_back(e.id());
+        else
+            Physics::set_user_data(pc.handle, e.id());
     });
 
+    // batched with everything else removed before the next physics step
     world.observer<Physics_Component>()
     .event(flecs::OnRemove)
     .each([this](Entity e, const Physics_Component& pc) {
-        Physics::remove_body(pc.handle);
+        Physics::queue_remove_body(pc.handle);
     });
 
+#ifdef FIREBALL_CLIENT
+    // multi threaded systems run as jobs on the engine workers. the tasks of
+    // a frame wait on each other, so never more than can run at once. only
+    // the client has one, the server would wake the workers for nothing
+    uint32_t workers = Jobs::thread_count() - Jobs::max_background_jobs();
+    if (workers > 0)
+        world.set_task_threads(static_cast<int32_t>(workers) + 1);
+
+    // runs before Transform_System so the sampled transform is used this frame.
+    // every entity only touches its own transform, split across the workers
+    // the time is a singleton term, looked up once per table instead of per entity
+    world.system<const Interpolation_Time, const Interpolation_Component, Transform_Component>("Interpolation_System")
+    .term_at(0).singleton()
+    .kind(flecs::PreUpdate)
+    .multi_threaded()
+    .each([](const Interpolation_Time& time, const Interpolation_Component& ic, Transform_Component& t) {
+        Interpolation_Component::Sample s;
+        if (!sample_interpolation(ic, time.render_time, time.max_extrapolation, s))
+            return;
+
+        // entities at rest keep their cached matrix
+        vec3 rotation = quat_to_euler(s.rotation);
+        if (t.position == s.position && t.rotation == rotation && t.scale == s.scale)
+            return;
+
+        t.position = s.position;
+        t.rotation = rotation;
+        t.scale = s.scale;
+        t.dirty = true;
+    });
+#endif
+
     world.system<Transform_Component>("Transform_System")
     .kind(flecs::OnUpdate)
     .multi_threaded(false)
@@ -47,6 +78,7 @@ Scene::Scene(Vk_Backend* _renderer) {
         if (e.has<Motion>()) {
             t.rotation.y += 0.01f;
             t.dirty = true;
+            e.modified<Transform_Component>();
         }
 
         if (!t.dirty && (!parent_transform || !parent_transform->updated)) {
@@ -146,9 +178,173 @@ Scene::Scene(Vk_Backend* _renderer) {
 }
 
 void Scene::update(float dt) {
+    create_pending_bodies();
+    sync_physics_bodies();
+    drain_physics_events();
     world.progress(dt);
 }
 
+// blended between the body's last two steps, the quaternion is only turned
+// into the transform's euler angles here
+static void write_body_transform(Entity e, const Physics_Component& pc, float alpha) {
+    vec3 position = pc.current_position;
+    quat orientation = pc.current_orientation;
+    if (alpha < 1.0f && pc.previous_position != pc.current_position)
+        position = mix(pc.previous_position, pc.current_position, alpha);
+    if (alpha < 1.0f && pc.previous_orientation != pc.current_orientation)
+        orientation = slerp(pc.previous_orientation, pc.current_orientation, alpha);
+    vec3 rotation = quat_to_euler(orientation);
+
+    Transform_Component& tc = e.get_mut<Transform_Component>();
+
+    // resting bodies are left alone so they do not count as changed
+    if (position == tc.position && rotation == tc.rotation)
+        return;
+
+    tc.position = position;
+    tc.rotation = rotation;
+    tc.dirty = true;
+    e.modified<Transform_Component>();
+}
+
+// physics -> transforms. after a step only the bodies that are awake are
+// read, in bulk, and only their entities are touched. with mostly sleeping
+// bodies that is a small fraction of all of them
+void Scene::sync_physics_bodies() {
+    uint64_t step = Physics::step_count();
+
+    if (step != m_synced_step) {
+        m_synced_step = step;
+        Physics::read_active_bodies(m_active_bodies);
+
+        m_was_moving.swap(m_moving);
+        m_moving.clear();
+
+        for (const Physics_Body_State& body : m_active_bodies) {
+            Entity e(world, body.user_data);
+            if (!body.user_data || !e.is_alive()) continue;
+
+            Physics_Component* pc = e.try_get_mut<Physics_Component>();
+            if (!pc) continue;
+
+            // several steps in one frame blend from the last one we saw, close enough
+            bool first = pc->synced_step == UINT64_MAX;
+            pc->previous_position = first ? body.position : pc->current_position;
+            pc->previous_orientation = first ? body.orientation : pc->current_orientation;
+            pc->current_position = body.position;
+            pc->current_orientation = body.orientation;
+            pc->synced_step = step;
+
+            m_moving.push_back(body.user_data);
+        }
+
+        // fell asleep since, shown where they stopped
+        for (flecs::entity_t id : m_was_moving) {
+            Entity e(world, id);
+            if (!e.is_alive()) continue;
+
+            Physics_Component* pc = e.try_get_mut<Physics_Component>();
+            if (!pc || pc->synced_step == step) continue;
+
+            pc->previous_position = pc->current_position;
+            pc->previous_orientation = pc->current_orientation;
+            write_body_transform(e, *pc, 1.0f);
+        }
+    }
+
+    float alpha = Physics::alpha();
+    for (flecs::entity_t id : m_moving) {
+        Entity e(world, id);
+        const Physics_Component* pc = e.is_alive() ? e.try_get<Physics_Component>() : nullptr;
+        if (pc)
+            write_body_transform(e, *pc, alpha);
+    }
+}
+
+// physics events -> the Physics_Contacts singleton and Physics_Sleeping tags,
+// read once per update after the steps that produced them
+void Scene::drain_physics_events() {
+    Physics::drain_events(m_physics_events);
+
+    Physics_Contacts& contacts = world.ensure<Physics_Contacts>();
+    contacts.added.clear();
+    contacts.persisted.clear();
+    contacts.removed.clear();
+
+    for (const Physics_Event& event : m_physics_events) {
+        Physics_Contact contact = { event.user_data1, event.user_data2, event.point, event.normal, event.impulse };
+
+        switch (event.type) {
+        case Physics_Event_Type::Contact_Added:     contacts.added.push_back(contact); break;
+        case Physics_Event_Type::Contact_Persisted: contacts.persisted.push_back(contact); break;
+        case Physics_Event_Type::Contact_Removed:   contacts.removed.push_back(contact); break;
+        case Physics_Event_Type::Activated:
+        case Physics_Event_Type::Deactivated: {
+            Entity e(world, event.user_data1);
+            if (!event.user_data1 || !e.is_alive()) break;
+
+            if (event.type == Physics_Event_Type::Activated)
+                e.remove<Physics_Sleeping>();
+            else
+                e.add<Physics_Sleeping>();
+            break;
+        }
+        }
+    }
+}
+
+// load_model returns before the model is loaded, its mesh body is made once it is.
+// a model that was never loaded, as on the server, fails in add_objects
+static bool waiting_for_model(const Physics_Info& info) {
+    if (info.shape != Physics_Shape::Mesh) return false;
+    if (!info.model.animated && info.model.index >= Model_Manager::get_num_models()) return false;
+    return Model_Manager::get_model(info.model).loading_state != Loading_State::Loaded;
+}
+
+// one broadphase insertion per batch instead of one per body, for level
+// loads and mass spawns
+void Scene::create_pending_bodies() {
+    if (m_pending_bodies.empty()) return;
+
+    // OnSet fires on every set while the body does not exist yet
+    std::sort(m_pending_bodies.begin(), m_pending_bodies.end());
+    m_pending_bodies.erase(std::unique(m_pending_bodies.begin(), m_pending_bodies.end()), m_pending_bodies.end());
+
+    for (bool is_static : { true, false }) {
+        m_batch_entities.clear();
+        m_batch_infos.clear();
+        m_batch_user_data.clear();
+
+        for (flecs::entity_t id : m_pending_bodies) {
+            Entity e(world, id);
+            if (!e.is_alive()) continue;
+
+            const Physics_Component* pc = e.try_get<Physics_Component>();
+            if (!pc || !pc->handle.IsInvalid() || pc->is_static != is_static) continue;
+            if (waiting_for_model(pc->info)) continue;
+
+            m_batch_entities.push_back(id);
+            m_batch_infos.push_back(pc->info);
+            m_batch_user_data.push_back(id);
+        }
+
+        if (m_batch_entities.empty()) continue;
+
+        m_batch_handles.resize(m_batch_infos.size());
+        Physics::add_objects(m_batch_infos, is_static, m_batch_handles, m_batch_user_data);
+
+        for (size_t i = 0; i < m_batch_entities.size(); i++)
+            Entity(world, m_batch_entities[i]).get_mut<Physics_Component>().handle = m_batch_handles[i];
+    }
+
+    // only mesh bodies whose model is still loading stay
+    std::erase_if(m_pending_bodies, [this](flecs::entity_t id) {
+        Entity e(world, id);
+        const Physics_Component* pc = e.is_alive() ? e.try_get<Physics_Component>() : nullptr;
+        return !pc || !pc->handle.IsInvalid() || !waiting_for_model(pc->info);
+    });
+}
+
 Entity Scene::create_entity(const std::string& name) {
     auto e = world.entity()
         .add<Transform_Component>()
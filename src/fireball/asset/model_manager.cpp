@@ -3,6 +3,7 @@
 #include "asset/model.h"
 #include "texture_manager.h"
 
+#include "fireball/core/jobs.h"
 #include "fireball/util/time.h"
 
 #include <assimp/GltfMaterial.h>
@@ -10,10 +11,8 @@
 #include <stb_image.h>
 
 #include <mutex>
-#include <thread>
 
 using std::mutex;
-using std::thread;
 
 struct Animation {
     std::string name;
@@ -69,7 +68,7 @@ namespace Model_Manager {
 
     static mutex model_mutex;
     static mutex data_mutex;
-    static vector<thread> loading_threads;
+    static Job_Counter loading_jobs;
 
     mat4 assimp_to_glm(const aiMatrix4x4& ai_mat) {
         return mat4(
@@ -88,6 +87,10 @@ namespace Model_Manager {
 
     }
 
+    const std::string& get_base_path() {
+        return base_path;
+    }
+
     bool model_loaded(const std::string& full_path, Model_Handle& handle) {
         // TODO check handle for animated and search accordingly
         for (size_t i = 0; i < g_models.size(); i++) {
@@ -119,7 +122,10 @@ namespace Model_Manager {
             g_models.push_back(model);
         model_mutex.unlock();
 
-        loading_threads.emplace_back(load_model_async, full_path, handle, mesh_opt_flags);
+        // Low, a level load shares the workers with the physics step
+        Jobs::submit([full_path, handle, mesh_opt_flags]() {
+            load_model_async(full_path, handle, mesh_opt_flags);
+        }, Job_Priority::Low, &loading_jobs);
 
         return handle;
     }
@@ -525,10 +531,7 @@ namespace Model_Manager {
     }
 
     void wait_for_all_loads() {
-        for (thread& load : loading_threads)
-            load.join();
-
-        loading_threads.clear();
+        Jobs::wait(loading_jobs);
 
         for (const Model& model : g_models)
             assert(model.loading_state == Loading_State::Loaded);
@@ -542,6 +545,10 @@ namespace Model_Manager {
         return g_indices;
     }
 
+    std::unique_lock<std::mutex> lock_geometry() {
+        return std::unique_lock<std::mutex>(data_mutex);
+    }
+
     std::vector<Model>& get_models() {
         return g_models;
     }
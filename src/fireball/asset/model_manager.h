@@ -8,6 +8,7 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <mutex>
 #include <span>
 #include <string>
 #include <vector>
@@ -54,6 +55,7 @@ namespace Model_Manager {
 
     void init(const std::string& base, bool headless = false);
     void cleanup();
+    const std::string& get_base_path();
 
     bool model_loaded(const std::string& full_path, Model_Handle& model_index);
     
@@ -78,6 +80,8 @@ namespace Model_Manager {
 
     vector<Vertex>& get_vertices();
     vector<uint32_t>& get_indices();
+    // hold it while reading the two above from another thread, loads append to them
+    std::unique_lock<std::mutex> lock_geometry();
     vector<Model>& get_models();
     std::span<const Bone> get_model_bones(Model_Handle handle);
     Model_Handle get_handle(const std::string& str);
@@ -1,5 +1,6 @@
 #include "texture_manager.h"
 
+#include "fireball/core/jobs.h"
 #include "fireball/renderer/vk_types.h"
 #include "fireball/renderer/vk_util.h"
 #include "fireball/util/math.h"
@@ -11,10 +12,8 @@
 #include <cmath>
 #include <map>
 #include <mutex>
-#include <thread>
 
 using std::mutex;
-using std::thread;
 
 #define VK_CHECK(x)																  \
     do {																		  \
@@ -53,7 +52,7 @@ namespace Texture_Manager {
 	static mutex vma_mutex;
 	static mutex immediate_mutex;
 	static mutex device_mutex;
-	static vector<thread> loading_threads;
+	static Job_Counter loading_jobs;
 
     void init(Vk_Backend* _renderer) {
 		renderer = _renderer;
@@ -155,7 +154,9 @@ namespace Texture_Manager {
 		// start load for resources handle points at
 		// return handle
 
-		loading_threads.emplace_back(load_async, file_path, bindless_id);
+		Jobs::submit([file_path, bindless_id]() {
+			load_async(file_path, bindless_id);
+		}, Job_Priority::Low, &loading_jobs);
 
 		return bindless_id;
 	}
@@ -341,10 +342,7 @@ namespace Texture_Manager {
 	}
 
 	void wait_for_all_loads() {
-		for (thread& load : loading_threads)
-			load.join();
-
-		loading_threads.clear();
+		Jobs::wait(loading_jobs);
 
 		for (const auto& [path, texture] : textures)
 			assert(texture.loading_state == Texture_Loading_State::Loaded);
@@ -0,0 +1,260 @@
+#include "jobs.h"
+
+#include <flecs.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Jobs {
+    struct Job {
+        Job_Function function;
+        void* data;
+        Job_Counter* counter;
+        Job_Priority priority;
+    };
+
+    // the owner pushes and pops at the back, thieves take from the front
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> queues[JOB_PRIORITY_COUNT];
+    };
+
+    static std::vector<std::unique_ptr<Worker>> g_workers;
+    static std::vector<std::thread> g_threads;
+    static uint32_t g_max_low = 1;
+
+    static std::atomic<uint32_t> g_queued[JOB_PRIORITY_COUNT] = {};
+    static std::atomic<uint32_t> g_running_low = 0;
+    static std::atomic<uint32_t> g_next_worker = 0;
+    static std::atomic<bool> g_stop = false;
+
+    // idle workers sleep here, submit only takes the lock when one does
+    static std::mutex g_sleep_mutex;
+    static std::condition_variable g_wake;
+    static std::atomic<uint32_t> g_sleeping = 0;
+
+    static thread_local int32_t t_worker = -1;
+
+    static bool has_runnable() {
+        return g_queued[0] > 0 || g_queued[1] > 0 || (g_queued[2] > 0 && g_running_low < g_max_low);
+    }
+
+    static void wake_one() {
+        if (g_sleeping == 0) return;
+        { std::lock_guard<std::mutex> lock(g_sleep_mutex); }
+        g_wake.notify_one();
+    }
+
+    static bool try_pop(Worker& worker, uint32_t priority, bool own, Job& out) {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        std::deque<Job>& queue = worker.queues[priority];
+        if (queue.empty()) return false;
+
+        if (own) {
+            out = queue.back();
+            queue.pop_back();
+        } else {
+            out = queue.front();
+            queue.pop_front();
+        }
+        g_queued[priority]--;
+        return true;
+    }
+
+    // highest priority first, our own queue before the others'. a Low job
+    // holds one of the g_max_low slots until it has run
+    static bool find_job(uint32_t self, bool allow_low, Job& out) {
+        const uint32_t count = static_cast<uint32_t>(g_workers.size());
+
+        for (uint32_t p = 0; p < JOB_PRIORITY_COUNT; p++) {
+            if (g_queued[p] == 0) continue;
+
+            bool low = p == static_cast<uint32_t>(Job_Priority::Low);
+            if (low) {
+                if (!allow_low) return false;
+                if (g_running_low.fetch_add(1) >= g_max_low) {
+                    g_running_low--;
+                    return false;
+                }
+            }
+
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t victim = (self + i) % count;
+                if (try_pop(*g_workers[victim], p, static_cast<int32_t>(victim) == t_worker, out))
+                    return true;
+            }
+
+            if (low)
+                g_running_low--;
+        }
+        return false;
+    }
+
+    static void run(const Job& job) {
+        job.function(job.data);
+
+        if (job.priority == Job_Priority::Low) {
+            g_running_low--;
+            if (g_queued[static_cast<uint32_t>(Job_Priority::Low)] > 0)
+                wake_one();
+        }
+        if (job.counter)
+            job.counter->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    static void worker_main(uint32_t index) {
+        t_worker = static_cast<int32_t>(index);
+
+        for (;;) {
+            Job job;
+            if (find_job(index, true, job)) {
+                run(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(g_sleep_mutex);
+            g_sleeping++;
+            g_wake.wait(lock, [] { return g_stop || has_runnable(); });
+            g_sleeping--;
+
+            if (g_stop && !has_runnable())
+                return;
+        }
+    }
+
+    // flecs task threads run as jobs. a task may block on the other tasks of
+    // the same frame, Scene never starts more of them than there are workers
+    // that can not be taken by Low jobs
+    struct Flecs_Task {
+        ecs_os_thread_callback_t callback;
+        void* arg;
+        void* result = nullptr;
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+    };
+
+    static ecs_os_thread_t flecs_task_new(ecs_os_thread_callback_t callback, void* arg) {
+        Flecs_Task* task = new Flecs_Task{ callback, arg };
+        submit([](void* data) {
+            Flecs_Task* task = static_cast<Flecs_Task*>(data);
+            void* result = task->callback(task->arg);
+
+            std::lock_guard<std::mutex> lock(task->mutex);
+            task->result = result;
+            task->done = true;
+            task->finished.notify_one();
+        }, task, Job_Priority::Normal);
+        return reinterpret_cast<ecs_os_thread_t>(task);
+    }
+
+    // sleeps instead of helping, the job picked up could be another task
+    // waiting on this frame. the core is free for the workers meanwhile
+    static void* flecs_task_join(ecs_os_thread_t thread) {
+        Flecs_Task* task = reinterpret_cast<Flecs_Task*>(thread);
+        {
+            std::unique_lock<std::mutex> lock(task->mutex);
+            task->finished.wait(lock, [task] { return task->done; });
+        }
+
+        void* result = task->result;
+        delete task;
+        return result;
+    }
+
+    void init(uint32_t threads) {
+        if (!g_threads.empty()) return;
+
+        if (threads == 0)
+            threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        g_max_low = std::max(threads / 2, 1u);
+        g_stop = false;
+
+        for (uint32_t i = 0; i < threads; i++)
+            g_workers.push_back(std::make_unique<Worker>());
+        for (uint32_t i = 0; i < threads; i++)
+            g_threads.emplace_back(worker_main, i);
+
+        ecs_os_set_api_defaults();
+        ecs_os_api_t api = ecs_os_api;
+        api.task_new_ = flecs_task_new;
+        api.task_join_ = flecs_task_join;
+        ecs_os_set_api(&api);
+
+        printf("[JOBS] %u workers, %u for background jobs\n", threads, g_max_low);
+    }
+
+    void shutdown() {
+        if (g_threads.empty()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(g_sleep_mutex);
+            g_stop = true;
+        }
+        g_wake.notify_all();
+
+        for (std::thread& thread : g_threads)
+            thread.join();
+        g_threads.clear();
+        g_workers.clear();
+    }
+
+    uint32_t thread_count() {
+        return static_cast<uint32_t>(g_threads.size());
+    }
+
+    uint32_t max_background_jobs() {
+        return g_threads.empty() ? 0 : g_max_low;
+    }
+
+    void submit(Job_Function function, void* data, Job_Priority priority, Job_Counter* counter) {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+        if (g_workers.empty()) {
+            function(data);
+            if (counter)
+                counter->pending.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+
+        // workers keep their own jobs, everyone else spreads them round robin
+        uint32_t index = t_worker >= 0
+            ? static_cast<uint32_t>(t_worker)
+            : g_next_worker.fetch_add(1, std::memory_order_relaxed) % g_workers.size();
+
+        Worker& worker = *g_workers[index];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queues[static_cast<uint32_t>(priority)].push_back({ function, data, counter, priority });
+            g_queued[static_cast<uint32_t>(priority)]++;
+        }
+        wake_one();
+    }
+
+    void submit(std::function<void()> job, Job_Priority priority, Job_Counter* counter) {
+        submit([](void* data) {
+            std::unique_ptr<std::function<void()>> job(static_cast<std::function<void()>*>(data));
+            (*job)();
+        }, new std::function<void()>(std::move(job)), priority, counter);
+    }
+
+    void wait(Job_Counter& counter, bool help) {
+        uint32_t self = t_worker >= 0 ? static_cast<uint32_t>(t_worker) : 0;
+
+        while (!counter.done()) {
+            Job job;
+            if (help && find_job(self, false, job))
+                run(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// engine wide job system
+// one worker per core less the main thread, shared by physics, ecs system
+// tasks and asset loading. every worker has a queue per priority, takes its
+// own newest job first and steals the oldest from the others when it runs
+// dry. higher priorities always go first, and only a few Low jobs run at
+// once so a level load never holds every worker while a step waits
+
+enum class Job_Priority : uint8_t {
+    High = 0, // physics, the main thread is waiting on it
+    Normal,   // ecs system tasks
+    Low       // asset loads, nobody waits on them this frame
+};
+
+constexpr uint32_t JOB_PRIORITY_COUNT = 3;
+
+// jobs of a group not finished yet
+struct Job_Counter {
+    std::atomic<uint32_t> pending = 0;
+
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+typedef void (*Job_Function)(void* data);
+
+namespace Jobs {
+    // threads 0: one per core less the main thread. installs the flecs task
+    // hooks, so call it before the first flecs world is created
+    void init(uint32_t threads = 0);
+    // runs what is still queued, then joins the workers
+    void shutdown();
+
+    uint32_t thread_count();
+    // Low jobs running at once at most, the other workers stay free
+    uint32_t max_background_jobs();
+
+    // without workers the job runs right away on the calling thread
+    void submit(Job_Function function, void* data, Job_Priority priority = Job_Priority::Normal, Job_Counter* counter = nullptr);
+    void submit(std::function<void()> job, Job_Priority priority = Job_Priority::Normal, Job_Counter* counter = nullptr);
+
+    // help runs High and Normal jobs on the calling thread until counter is
+    // done, never Low ones, they could take longer than what is waited on
+    void wait(Job_Counter& counter, bool help = true);
+}
@@ -1,15 +1,26 @@
 #include "physics.h"
 
+#include "jobs.h"
+
+#include "fireball/asset/model_manager.h"
+#include "fireball/util/time.h"
+
 #include <Jolt/Jolt.h>
 #include <Jolt/RegisterTypes.h>
 #include <Jolt/Core/Factory.h>
 #include <Jolt/Core/TempAllocator.h>
-#include <Jolt/Core/JobSystemThreadPool.h>
+#include <Jolt/Core/JobSystemWithBarrier.h>
+#include <Jolt/Core/FixedSizeFreeList.h>
 #include <Jolt/Physics/PhysicsSettings.h>
 #include <Jolt/Physics/PhysicsSystem.h>
 #include <Jolt/Physics/Collision/Shape/BoxShape.h>
 #include <Jolt/Physics/Collision/Shape/SphereShape.h>
 #include <Jolt/Physics/Collision/Shape/CylinderShape.h>
+#include <Jolt/Physics/Collision/Shape/MeshShape.h>
+#include <Jolt/Physics/Collision/Shape/ConvexHullShape.h>
+#include <Jolt/Physics/Collision/Shape/ScaledShape.h>
+#include <Jolt/Core/StreamWrapper.h>
+#include <Jolt/Physics/StateRecorder.h>
 #include <Jolt/Physics/Body/BodyCreationSettings.h>
 #include <Jolt/Physics/Body/BodyActivationListener.h>
 #include <Jolt/Physics/Collision/RayCast.h>
@@ -20,9 +31,18 @@
 #include <Jolt/Physics/Character/CharacterVirtual.h>
 #include <Jolt/Physics/Character/CharacterBase.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <cstdarg>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 using namespace JPH;
 using namespace JPH::literals;
@@ -34,32 +54,205 @@ namespace Physics {
     class MyContactListener;
     class MyBodyActivationListener;
 
+    // identical shapes are shared between bodies. scales are quantized to
+    // 1/1024 so bodies built from the same numbers find each other
+    struct ShapeKey {
+        Physics_Shape shape;
+        int32_t scale[3];
+        uint32_t model = 0;    // meshes only
+        bool animated = false; // meshes only, animated models are indexed apart from static ones
+        uint32_t variant = 0;  // meshes only, lod and whether it is a hull
+
+        bool operator==(const ShapeKey& o) const {
+            return shape == o.shape && scale[0] == o.scale[0] && scale[1] == o.scale[1] && scale[2] == o.scale[2]
+                && model == o.model && animated == o.animated && variant == o.variant;
+        }
+    };
+
+    struct ShapeKeyHash {
+        size_t operator()(const ShapeKey& k) const {
+            size_t h = std::hash<int>()(static_cast<int>(k.shape));
+            for (int32_t s : k.scale)
+                h = h * 31 + std::hash<int32_t>()(s);
+            h = h * 31 + std::hash<uint32_t>()(k.model);
+            h = h * 31 + std::hash<bool>()(k.animated);
+            h = h * 31 + std::hash<uint32_t>()(k.variant);
+            return h;
+        }
+    };
+
+    struct CachedShape {
+        RefConst<Shape> shape;
+        uint32_t bodies = 0;
+    };
+
+    // one saved tick, written into a buffer that keeps its capacity so once
+    // warm a save does not allocate
+    class RingStateRecorder final : public StateRecorder {
+    public:
+        uint32_t tick = 0; // 0: empty
+        std::vector<uint8_t> data;
+        std::vector<BodyID> bodies; // sorted, the subset saved, empty for all
+
+        void begin_write(uint32_t new_tick) {
+            tick = new_tick;
+            data.clear();
+            readPos = 0;
+            failed = false;
+        }
+
+        void begin_read() {
+            readPos = 0;
+            failed = false;
+        }
+
+        virtual void WriteBytes(const void* inData, size_t inNumBytes) override {
+            const uint8_t* bytes = static_cast<const uint8_t*>(inData);
+            data.insert(data.end(), bytes, bytes + inNumBytes);
+        }
+
+        virtual void ReadBytes(void* outData, size_t inNumBytes) override {
+            if (readPos + inNumBytes > data.size()) {
+                memset(outData, 0, inNumBytes);
+                failed = true;
+                return;
+            }
+            memcpy(outData, data.data() + readPos, inNumBytes);
+            readPos += inNumBytes;
+        }
+
+        virtual bool IsEOF() const override { return readPos >= data.size(); }
+        virtual bool IsFailed() const override { return failed; }
+
+    private:
+        size_t readPos = 0;
+        bool failed = false;
+    };
+
+    // restricts a save to a set of bodies and the contacts they take part in
+    class BodySetFilter final : public StateRecorderFilter {
+    public:
+        explicit BodySetFilter(const std::vector<BodyID>& bodies) : mBodies(bodies) {}
+
+        virtual bool ShouldSaveBody(const Body& inBody) const override {
+            return contains(inBody.GetID());
+        }
+
+        virtual bool ShouldSaveContact(const BodyID& inBody1, const BodyID& inBody2) const override {
+            return contains(inBody1) || contains(inBody2);
+        }
+
+    private:
+        const std::vector<BodyID>& mBodies;
+
+        bool contains(const BodyID& id) const {
+            return std::binary_search(mBodies.begin(), mBodies.end(), id);
+        }
+    };
+
+    // events of one physics thread, only ever written by that thread
+    struct EventBuffer {
+        std::vector<Physics_Event> events;
+    };
+
+    // threads past this drop their events
+    static constexpr uint32_t cMaxEventThreads = 64;
+
+    // Jolt's jobs run as High priority jobs on the engine workers instead of
+    // a thread pool of its own. the thread calling Update also runs them
+    // while it waits on a barrier
+    class SharedJobSystem final : public JobSystemWithBarrier {
+    public:
+        SharedJobSystem(uint inMaxJobs, uint inMaxBarriers) : JobSystemWithBarrier(inMaxBarriers) {
+            mJobs.Init(inMaxJobs, inMaxJobs);
+        }
+
+        virtual int GetMaxConcurrency() const override {
+            return static_cast<int>(Jobs::thread_count()) + 1;
+        }
+
+        virtual JobHandle CreateJob(const char* inName, ColorArg inColor, const JobFunction& inJobFunction, uint32 inNumDependencies = 0) override {
+            uint32 index;
+            for (;;) {
+                index = mJobs.ConstructObject(inName, inColor, this, inJobFunction, inNumDependencies);
+                if (index != AvailableJobs::cInvalidObjectIndex) break;
+                JPH_ASSERT(false, "No jobs available!");
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            Job* job = &mJobs.Get(index);
+
+            // the handle holds a reference, the job can not be freed before it is queued
+            JobHandle handle(job);
+            if (inNumDependencies == 0)
+                QueueJob(job);
+            return handle;
+        }
+
+    protected:
+        virtual void QueueJob(Job* inJob) override {
+            inJob->AddRef();
+            Jobs::submit(run, inJob, Job_Priority::High);
+        }
+
+        virtual void QueueJobs(Job** inJobs, uint inNumJobs) override {
+            for (uint i = 0; i < inNumJobs; i++)
+                QueueJob(inJobs[i]);
+        }
+
+        virtual void FreeJob(Job* inJob) override {
+            mJobs.DestructObject(inJob);
+        }
+
+    private:
+        using AvailableJobs = FixedSizeFreeList<Job>;
+        AvailableJobs mJobs;
+
+        // does nothing if a barrier already ran it
+        static void run(void* data) {
+            Job* job = static_cast<Job*>(data);
+            job->Execute();
+            job->Release();
+        }
+    };
+
     struct PhysicsState {
         std::unique_ptr<TempAllocatorImpl> tempAllocator;
-        std::unique_ptr<JobSystemThreadPool> jobSystem;
+        std::unique_ptr<JobSystem> jobSystem;
         std::unique_ptr<PhysicsSystem> physicsSystem;
         std::unique_ptr<BPLayerInterfaceImpl> broadPhaseLayerInterface;
         std::unique_ptr<ObjectVsBroadPhaseLayerFilterImpl> objectVsBroadphaseLayerFilter;
         std::unique_ptr<ObjectLayerPairFilterImpl> objectVsObjectLayerFilter;
         std::unique_ptr<MyBodyActivationListener> bodyActivationListener;
         std::unique_ptr<MyContactListener> contactListener;
-    };
 
-    static PhysicsState g_state;
+        float fixedStep = 1.0f / 60.0f;
+        uint32_t maxSteps = 4;
+        bool interpolate = true;
+        double accumulator = 0.0;
+        uint64_t stepCount = 0;
 
-    namespace Layers {
-        static constexpr ObjectLayer NON_MOVING = 0;
-        static constexpr ObjectLayer MOVING = 1;
-        static constexpr ObjectLayer CHARACTER = 2;
-        static constexpr ObjectLayer NUM_LAYERS = 3;
-    };
+        std::vector<BodyID> pendingRemovals;
+        BodyIDVector activeBodies;
+
+        std::unordered_map<ShapeKey, CachedShape, ShapeKeyHash> shapes;
+        std::unordered_map<const Shape*, ShapeKey> shapeKeys;
+        std::string shapeCacheDir = "shape_cache/";
 
-    namespace BroadPhaseLayers {
-        static constexpr BroadPhaseLayer NON_MOVING(0);
-        static constexpr BroadPhaseLayer MOVING(1);
-        static constexpr uint NUM_LAYERS(2);
+        std::vector<std::unique_ptr<RingStateRecorder>> stateRing;
+
+        Physics_Collision_Matrix layers;
+        uint32_t broadPhaseMasks[PHYSICS_MAX_LAYERS] = {};
+
+        uint32_t eventMask = PHYSICS_EVENTS_DEFAULT;
+        EventBuffer eventBuffers[cMaxEventThreads];
+        std::atomic<uint32_t> eventThreads = 0;
+        // bumped by init, threads claim a buffer again after a restart
+        std::atomic<uint32_t> eventGeneration = 0;
+        std::atomic<uint32_t> droppedEvents = 0;
     };
 
+    static PhysicsState g_state;
+
     static void TraceImpl(const char* inFMT, ...) {
         va_list list;
         va_start(list, inFMT);
@@ -76,66 +269,113 @@ namespace Physics {
     };
 #endif
 
+    // all three read the collision matrix in g_state. object vs broadphase
+    // masks are derived from it, bit b set if the layer collides with any
+    // layer in tree b
     class ObjectLayerPairFilterImpl : public ObjectLayerPairFilter {
     public:
         virtual bool ShouldCollide(ObjectLayer inObject1, ObjectLayer inObject2) const override {
-            switch (inObject1) {
-            case Layers::NON_MOVING:
-                return inObject2 == Layers::MOVING;
-            case Layers::MOVING:
-                return true;
-            default:
-                JPH_ASSERT(false);
-                return false;
-            }
+            return g_state.layers.should_collide(static_cast<uint8_t>(inObject1), static_cast<uint8_t>(inObject2));
         }
     };
 
     class BPLayerInterfaceImpl final : public BroadPhaseLayerInterface {
     public:
-        BPLayerInterfaceImpl() {
-            mObjectToBroadPhase[Layers::NON_MOVING] = BroadPhaseLayers::NON_MOVING;
-            mObjectToBroadPhase[Layers::MOVING] = BroadPhaseLayers::MOVING;
-        }
-
         virtual uint GetNumBroadPhaseLayers() const override {
-            return BroadPhaseLayers::NUM_LAYERS;
+            return g_state.layers.num_broad_phase_layers;
         }
 
         virtual BroadPhaseLayer GetBroadPhaseLayer(ObjectLayer inLayer) const override {
-            JPH_ASSERT(inLayer < Layers::NUM_LAYERS);
-            return mObjectToBroadPhase[inLayer];
+            JPH_ASSERT(inLayer < g_state.layers.num_layers);
+            return BroadPhaseLayer(g_state.layers.broad_phase[inLayer]);
         }
 
 #if defined(JPH_EXTERNAL_PROFILE) || defined(JPH_PROFILE_ENABLED)
         virtual const char* GetBroadPhaseLayerName(BroadPhaseLayer inLayer) const override {
-            switch ((BroadPhaseLayer::Type)inLayer) {
-            case (BroadPhaseLayer::Type)BroadPhaseLayers::NON_MOVING: return "NON_MOVING";
-            case (BroadPhaseLayer::Type)BroadPhaseLayers::MOVING: return "MOVING";
-            default: JPH_ASSERT(false); return "INVALID";
-            }
+            static const char* names[PHYSICS_MAX_BROAD_PHASE_LAYERS] = { "BP0", "BP1", "BP2", "BP3", "BP4", "BP5", "BP6", "BP7" };
+            return (BroadPhaseLayer::Type)inLayer < PHYSICS_MAX_BROAD_PHASE_LAYERS ? names[(BroadPhaseLayer::Type)inLayer] : "INVALID";
         }
 #endif
-
-    private:
-        BroadPhaseLayer mObjectToBroadPhase[Layers::NUM_LAYERS];
     };
 
     class ObjectVsBroadPhaseLayerFilterImpl : public ObjectVsBroadPhaseLayerFilter {
     public:
         virtual bool ShouldCollide(ObjectLayer inLayer1, BroadPhaseLayer inLayer2) const override {
-            switch (inLayer1) {
-            case Layers::NON_MOVING:
-                return inLayer2 == BroadPhaseLayers::MOVING;
-            case Layers::MOVING:
-                return true;
-            default:
-                JPH_ASSERT(false);
-                return false;
+            if (inLayer1 >= g_state.layers.num_layers) return false;
+            return g_state.broadPhaseMasks[inLayer1] >> (BroadPhaseLayer::Type)inLayer2 & 1u;
+        }
+    };
+
+    static void rebuild_broad_phase_masks() {
+        const Physics_Collision_Matrix& m = g_state.layers;
+        for (uint32_t a = 0; a < PHYSICS_MAX_LAYERS; a++) {
+            uint32_t mask = 0;
+            for (uint32_t b = 0; a < m.num_layers && b < m.num_layers; b++) {
+                if (m.collides[a] >> b & 1u)
+                    mask |= 1u << m.broad_phase[b];
             }
+            g_state.broadPhaseMasks[a] = mask;
         }
+    }
+
+    struct ThreadEvents {
+        uint32_t generation = 0;
+        EventBuffer* buffer = nullptr;
     };
 
+    static thread_local ThreadEvents t_events;
+
+    static bool wants_event(Physics_Event_Type type) {
+        return g_state.eventMask >> static_cast<uint32_t>(type) & 1u;
+    }
+
+    static void push_event(const Physics_Event& event) {
+        uint32_t generation = g_state.eventGeneration.load(std::memory_order_relaxed);
+        if (t_events.generation != generation) {
+            uint32_t slot = g_state.eventThreads.fetch_add(1, std::memory_order_relaxed);
+            t_events.buffer = slot < cMaxEventThreads ? &g_state.eventBuffers[slot] : nullptr;
+            t_events.generation = generation;
+        }
+
+        if (!t_events.buffer) {
+            g_state.droppedEvents.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        t_events.buffer->events.push_back(event);
+    }
+
+    static vec3 to_vec3(Vec3Arg v) {
+        return vec3(v.GetX(), v.GetY(), v.GetZ());
+    }
+
+    static void push_contact(Physics_Event_Type type, const Body& inBody1, const Body& inBody2, const ContactManifold& inManifold) {
+        if (!wants_event(type)) return;
+
+        RVec3 point = inManifold.mRelativeContactPointsOn1.empty()
+            ? inBody1.GetCenterOfMassPosition()
+            : inManifold.GetWorldSpaceContactPointOn1(0);
+
+        // closing speed along the normal times the pair's reduced mass, the
+        // impulse that would stop them. static and kinematic bodies are infinitely heavy
+        Vec3 relative = inBody2.GetPointVelocity(point) - inBody1.GetPointVelocity(point);
+        float closing = std::max(-relative.Dot(inManifold.mWorldSpaceNormal), 0.0f);
+        float inverse_mass = (inBody1.IsDynamic() ? inBody1.GetMotionProperties()->GetInverseMass() : 0.0f)
+                           + (inBody2.IsDynamic() ? inBody2.GetMotionProperties()->GetInverseMass() : 0.0f);
+
+        Physics_Event event;
+        event.type = type;
+        event.body1 = inBody1.GetID();
+        event.body2 = inBody2.GetID();
+        event.user_data1 = inBody1.GetUserData();
+        event.user_data2 = inBody2.GetUserData();
+        event.point = vec3(point.GetX(), point.GetY(), point.GetZ());
+        event.normal = to_vec3(inManifold.mWorldSpaceNormal);
+        event.impulse = inverse_mass > 0.0f ? closing / inverse_mass : 0.0f;
+        push_event(event);
+    }
+
+    // called from the physics jobs, under the body locks. nothing here may
+    // block or allocate more than the buffer growing
     class MyContactListener : public ContactListener {
     public:
         virtual ValidateResult OnContactValidate(const Body& inBody1, const Body& inBody2, RVec3Arg inBaseOffset, const CollideShapeResult& inCollisionResult) override {
@@ -143,34 +383,61 @@ namespace Physics {
         }
 
         virtual void OnContactAdded(const Body& inBody1, const Body& inBody2, const ContactManifold& inManifold, ContactSettings& ioSettings) override {
-            // Handle contact added
-            //std::cout << "A contact was added" << std::endl;
+            push_contact(Physics_Event_Type::Contact_Added, inBody1, inBody2, inManifold);
         }
 
         virtual void OnContactPersisted(const Body& inBody1, const Body& inBody2, const ContactManifold& inManifold, ContactSettings& ioSettings) override {
-            // Handle contact persisted
-            //std::cout << "A contact was persisted" << std::endl;
+            push_contact(Physics_Event_Type::Contact_Persisted, inBody1, inBody2, inManifold);
         }
 
+        // the bodies may already be gone, only their ids are safe to use
         virtual void OnContactRemoved(const SubShapeIDPair& inSubShapePair) override {
-            // Handle contact removed
-            //std::cout << "A contact was removed" << std::endl;
+            if (!wants_event(Physics_Event_Type::Contact_Removed)) return;
+
+            Physics_Event event;
+            event.type = Physics_Event_Type::Contact_Removed;
+            event.body1 = inSubShapePair.GetBody1ID();
+            event.body2 = inSubShapePair.GetBody2ID();
+            push_event(event);
         }
     };
 
     class MyBodyActivationListener : public BodyActivationListener {
     public:
         virtual void OnBodyActivated(const BodyID& inBodyID, uint64 inBodyUserData) override {
-            std::cout << "A body got activated" << std::endl;
+            push_activation(Physics_Event_Type::Activated, inBodyID, inBodyUserData);
         }
 
         virtual void OnBodyDeactivated(const BodyID& inBodyID, uint64 inBodyUserData) override {
-            std::cout << "A body went to sleep" << std::endl;
+            push_activation(Physics_Event_Type::Deactivated, inBodyID, inBodyUserData);
+        }
+
+    private:
+        static void push_activation(Physics_Event_Type type, const BodyID& inBodyID, uint64 inBodyUserData) {
+            if (!wants_event(type)) return;
+
+            Physics_Event event;
+            event.type = type;
+            event.body1 = inBodyID;
+            event.user_data1 = inBodyUserData;
+            push_event(event);
         }
     };
 
     // Public API Implementation
-    bool init() {
+    bool init(const Physics_Collision_Matrix& layers) {
+        if (layers.num_layers == 0 || layers.num_broad_phase_layers == 0) {
+            printf("[PHYSICS] collision matrix has no layers\n");
+            return false;
+        }
+        g_state.layers = layers;
+        rebuild_broad_phase_masks();
+
+        for (EventBuffer& buffer : g_state.eventBuffers)
+            buffer.events.clear();
+        g_state.eventThreads = 0;
+        g_state.eventGeneration++;
+
         // Register allocation hook.In this example we'll just let Jolt use malloc / free but you can override these if you want (see Memory.h).
         // This needs to be done before any other Jolt function is called.
         RegisterDefaultAllocator();
@@ -195,10 +462,9 @@ namespace Physics {
         // malloc / free.
         g_state.tempAllocator = std::make_unique<TempAllocatorImpl>(10 * 1024 * 1024);
 
-        // We need a job system that will execute physics jobs on multiple threads. Typically
-        // you would implement the JobSystem interface yourself and let Jolt Physics run on top
-        // of your own job scheduler. JobSystemThreadPool is an example implementation.
-        g_state.jobSystem = std::make_unique<JobSystemThreadPool>(cMaxPhysicsJobs, cMaxPhysicsBarriers, std::thread::hardware_concurrency() - 1);
+        // We need a job system that will execute physics jobs on multiple threads.
+        // Physics runs on the engine workers, see SharedJobSystem. Jobs::init has to come first.
+        g_state.jobSystem = std::make_unique<SharedJobSystem>(cMaxPhysicsJobs, cMaxPhysicsBarriers);
 
         // This is the max amount of rigid bodies that you can add to the physics system. If you try to add more you'll get an error.
         // Note: This value is low because this is a simple test. For a real project use something in the order of 65536.
@@ -217,15 +483,13 @@ namespace Physics {
 
         // Create mapping table from object layer to broadphase layer
         // Note: As this is an interface, PhysicsSystem will take a reference to this so this instance needs to stay alive!
-        // Also have a look at BroadPhaseLayerInterfaceTable or BroadPhaseLayerInterfaceMask for a simpler interface.
+        // The three layer interfaces below read g_state.layers, see Physics_Collision_Matrix.
         g_state.broadPhaseLayerInterface = std::make_unique<BPLayerInterfaceImpl>();
         // Create class that filters object vs broadphase layers
         // Note: As this is an interface, PhysicsSystem will take a reference to this so this instance needs to stay alive!
-        // Also have a look at ObjectVsBroadPhaseLayerFilterTable or ObjectVsBroadPhaseLayerFilterMask for a simpler interface.
         g_state.objectVsBroadphaseLayerFilter = std::make_unique<ObjectVsBroadPhaseLayerFilterImpl>();
         // Create class that filters object vs object layers
         // Note: As this is an interface, PhysicsSystem will take a reference to this so this instance needs to stay alive!
-        // Also have a look at ObjectLayerPairFilterTable or ObjectLayerPairFilterMask for a simpler interface.
         g_state.objectVsObjectLayerFilter = std::make_unique<ObjectLayerPairFilterImpl>();
 
         // Now we can create the actual physics system.
@@ -260,6 +524,10 @@ namespace Physics {
             g_state.physicsSystem->SetContactListener(nullptr);
         }
 
+        g_state.pendingRemovals.clear();
+        g_state.shapeKeys.clear();
+        g_state.shapes.clear();
+        g_state.stateRing.clear();
         g_state.contactListener.reset();
         g_state.bodyActivationListener.reset();
         g_state.physicsSystem.reset();
@@ -278,54 +546,378 @@ namespace Physics {
         g_state.physicsSystem->Update(deltaTime, cCollisionSteps, g_state.tempAllocator.get(), g_state.jobSystem.get());
     }
 
+    void set_fixed_step(float step, uint32_t max_steps, bool interpolate) {
+        g_state.fixedStep = step;
+        g_state.maxSteps = max_steps;
+        g_state.interpolate = interpolate;
+        g_state.accumulator = 0.0;
+    }
+
+    uint32_t step(float real_dt) {
+        const double fixed = g_state.fixedStep;
+        // a caller that already steps fixed passes exactly fixedStep, rounding must not skip one
+        const double epsilon = fixed * 1e-3;
+
+        g_state.accumulator += real_dt;
+
+        if (!g_state.pendingRemovals.empty()) {
+            remove_bodies(g_state.pendingRemovals);
+            g_state.pendingRemovals.clear();
+        }
+
+        uint32_t steps = 0;
+        while (g_state.accumulator + epsilon >= fixed && steps < g_state.maxSteps) {
+            update(g_state.fixedStep);
+            g_state.accumulator = std::max(g_state.accumulator - fixed, 0.0);
+            g_state.stepCount++;
+            steps++;
+        }
+
+        // too slow to keep up, drop whole steps rather than spiral
+        if (g_state.accumulator >= fixed)
+            g_state.accumulator = std::fmod(g_state.accumulator, fixed);
+
+        return steps;
+    }
+
+    float fixed_step() {
+        return g_state.fixedStep;
+    }
+
+    float alpha() {
+        if (!g_state.interpolate) return 1.0f;
+        return static_cast<float>(g_state.accumulator / g_state.fixedStep);
+    }
+
+    uint64_t step_count() {
+        return g_state.stepCount;
+    }
+
+    void set_shape_cache_dir(const std::string& dir) {
+        g_state.shapeCacheDir = dir;
+        if (!dir.empty() && dir.back() != '/')
+            g_state.shapeCacheDir += '/';
+    }
+
     void optimize_broad_phase() {
         g_state.physicsSystem->OptimizeBroadPhase();
     }
 
-    Physics_Handle add_object(const Physics_Info& info, bool is_static) {
-        BodyInterface& body_interface = g_state.physicsSystem->GetBodyInterface();
+    // cooked mesh shapes, saved under the hash of the geometry they were
+    // cooked from so an unchanged model is only ever cooked once
+    static constexpr uint32_t COOKED_SHAPE_MAGIC = 0x4b4f4f43; // "COOK"
+    static constexpr uint32_t COOKED_SHAPE_VERSION = 1;
 
-        RVec3 position(info.pos.x, info.pos.y, info.pos.z);
-        Quat rotation(info.orientation.w, info.orientation.x, info.orientation.y, info.orientation.z);
+    static uint64_t fnv1a(uint64_t h, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            h ^= bytes[i];
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
 
-        EMotionType motion_type = is_static ? EMotionType::Static : EMotionType::Dynamic;
+    // the model's meshes at one lod, in model space. other models may still
+    // be loading into the shared arrays, they are read under their lock
+    static bool gather_geometry(Model_Handle handle, uint32_t lod, VertexList& vertices, IndexedTriangleList& triangles) {
+        // a headless Model_Manager (the server) never loads geometry
+        if (!handle.animated && handle.index >= Model_Manager::get_num_models()) return false;
 
-        RefConst<Shape> shape;
+        const Model& model = Model_Manager::get_model(handle);
+        if (model.loading_state != Loading_State::Loaded) return false;
+
+        std::unique_lock<std::mutex> lock = Model_Manager::lock_geometry();
+        const vector<Vertex>& all_vertices = Model_Manager::get_vertices();
+        const vector<uint32_t>& all_indices = Model_Manager::get_indices();
+        lod = std::min(lod, NUM_LODS - 1);
+
+        for (const Mesh& mesh : model.meshes) {
+            uint32_t first = static_cast<uint32_t>(vertices.size());
+
+            for (uint32_t i = 0; i < mesh.vertex_count; i++) {
+                vec3 p = vec3(mesh.transform * vec4(all_vertices[mesh.base_vertex + i].position, 1.0f));
+                vertices.push_back(Float3(p.x, p.y, p.z));
+            }
+
+            const Lod& l = mesh.lods[lod];
+            for (uint32_t i = 0; i + 2 < l.index_count; i += 3) {
+                const uint32_t* idx = &all_indices[l.base_index + i];
+                triangles.push_back(IndexedTriangle(first + idx[0], first + idx[1], first + idx[2]));
+            }
+        }
 
+        return !triangles.empty();
+    }
+
+    static std::string cooked_shape_path(uint64_t hash, bool convex) {
+        char name[64];
+        snprintf(name, sizeof(name), "%016llx_%s.jshape", static_cast<unsigned long long>(hash), convex ? "hull" : "mesh");
+        return g_state.shapeCacheDir + name;
+    }
+
+    static RefConst<Shape> load_cooked_shape(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return nullptr;
+
+        uint32_t magic = 0, version = 0;
+        file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (!file || magic != COOKED_SHAPE_MAGIC || version != COOKED_SHAPE_VERSION) return nullptr;
+
+        StreamInWrapper stream(file);
+        Shape::IDToShapeMap shapes;
+        Shape::IDToMaterialMap materials;
+        Shape::ShapeResult result = Shape::sRestoreWithChildren(stream, shapes, materials);
+        if (result.HasError() || stream.IsFailed()) {
+            printf("[PHYSICS] Stale cooked shape %s, cooking again\n", path.c_str());
+            return nullptr;
+        }
+
+        return result.Get();
+    }
+
+    static void save_cooked_shape(const std::string& path, const Shape* shape) {
+        std::error_code ec;
+        std::filesystem::create_directories(g_state.shapeCacheDir, ec);
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            printf("[PHYSICS] Could not write %s\n", path.c_str());
+            return;
+        }
+
+        file.write(reinterpret_cast<const char*>(&COOKED_SHAPE_MAGIC), sizeof(COOKED_SHAPE_MAGIC));
+        file.write(reinterpret_cast<const char*>(&COOKED_SHAPE_VERSION), sizeof(COOKED_SHAPE_VERSION));
+
+        StreamOutWrapper stream(file);
+        Shape::ShapeToIDMap shapes;
+        Shape::MaterialToIDMap materials;
+        shape->SaveWithChildren(stream, shapes, materials);
+    }
+
+    // static bodies collide with the triangles, dynamic ones with their
+    // convex hull, jolt does not simulate dynamic triangle meshes
+    static RefConst<Shape> cook_mesh_shape(const Physics_Info& info, bool convex) {
+        VertexList vertices;
+        IndexedTriangleList triangles;
+        if (!gather_geometry(info.model, info.lod, vertices, triangles)) {
+            printf("[PHYSICS] Model %u is not loaded, no mesh shape\n", info.model.index);
+            return nullptr;
+        }
+
+        uint64_t hash = 0xcbf29ce484222325ull;
+        hash = fnv1a(hash, &convex, sizeof(convex));
+        hash = fnv1a(hash, vertices.data(), vertices.size() * sizeof(Float3));
+        hash = fnv1a(hash, triangles.data(), triangles.size() * sizeof(IndexedTriangle));
+
+        const std::string path = cooked_shape_path(hash, convex);
+        if (RefConst<Shape> cached = load_cooked_shape(path))
+            return cached;
+
+        Time start_time = high_resolution_clock::now();
+
+        Shape::ShapeResult result;
+        if (convex) {
+            Array<Vec3> points;
+            points.reserve(vertices.size());
+            for (const Float3& v : vertices)
+                points.push_back(Vec3(v));
+            result = ConvexHullShapeSettings(points).Create();
+        }
+        else {
+            result = MeshShapeSettings(std::move(vertices), std::move(triangles)).Create();
+        }
+
+        if (result.HasError()) {
+            printf("[PHYSICS] Cooking model %u failed: %s\n", info.model.index, result.GetError().c_str());
+            return nullptr;
+        }
+
+        double elapsed = duration_cast<milliseconds>(high_resolution_clock::now() - start_time).count();
+        printf("[PHYSICS] Cooked %s for model %u in %.1f ms\n", convex ? "hull" : "mesh", info.model.index, elapsed);
+
+        save_cooked_shape(path, result.Get());
+        return result.Get();
+    }
+
+    static ShapeKey shape_key(const Physics_Info& info, bool is_static) {
+        auto quantize = [](float v) { return static_cast<int32_t>(std::lround(v * 1024.0f)); };
+
+        // only the dimensions the shape uses, a sphere's y and z do not matter
+        ShapeKey key = { info.shape, { quantize(info.scale.x), 0, 0 } };
+        if (info.shape == Physics_Shape::Box) {
+            key.scale[1] = quantize(info.scale.y);
+            key.scale[2] = quantize(info.scale.z);
+        }
+        else if (info.shape == Physics_Shape::Plane) {
+            key.scale[2] = quantize(info.scale.z);
+        }
+        else if (info.shape == Physics_Shape::Mesh) {
+            key.scale[1] = quantize(info.scale.y);
+            key.scale[2] = quantize(info.scale.z);
+            key.model = info.model.index;
+            key.animated = info.model.animated;
+            key.variant = info.lod << 1 | (is_static ? 0 : 1);
+        }
+        return key;
+    }
+
+    static RefConst<Shape> create_shape(const Physics_Info& info, bool is_static) {
         switch (info.shape) {
             case Physics_Shape::Box:
             {
                 Vec3 half_extents(info.scale.x * 0.5f, info.scale.y * 0.5f, info.scale.z * 0.5f);
-
-                    shape = new BoxShape(half_extents);
-                    break;
+                return new BoxShape(half_extents);
             }
 
             case Physics_Shape::Sphere:
             {
                 float radius = info.scale.x * 0.5f;
-                shape = new SphereShape(radius);
-                break;
+                return new SphereShape(radius);
             }
             
             case Physics_Shape::Plane:
             {
                 // TODO special jolt plane
                 Vec3 half_extents(info.scale.x * 0.5f, 0.5f, info.scale.z * 0.5f);
+                return new BoxShape(half_extents);
+            }
 
-                shape = new BoxShape(half_extents);
-                motion_type = EMotionType::Static;
-                break;
+            case Physics_Shape::Mesh:
+            {
+                RefConst<Shape> cooked = cook_mesh_shape(info, !is_static);
+                if (!cooked || info.scale == vec3(1.0f))
+                    return cooked;
+                return new ScaledShape(cooked, Vec3(info.scale.x, info.scale.y, info.scale.z));
             }
 
             default:
-                assert(false);
-                return Physics_Handle{ 0 };
+                return nullptr;
+        }
+    }
+
+    // null for shapes we can not build. every body created with the shape
+    // has to be counted with retain_shape, or the entry is never evicted
+    static RefConst<Shape> acquire_shape(const Physics_Info& info, bool is_static) {
+        ShapeKey key = shape_key(info, is_static);
+
+        auto it = g_state.shapes.find(key);
+        if (it != g_state.shapes.end())
+            return it->second.shape;
+
+        RefConst<Shape> shape = create_shape(info, is_static);
+        if (!shape) return nullptr;
+
+        g_state.shapes[key].shape = shape;
+        g_state.shapeKeys[shape.GetPtr()] = key;
+        return shape;
+    }
+
+    static void retain_shape(const Shape* shape) {
+        auto it = g_state.shapeKeys.find(shape);
+        if (it != g_state.shapeKeys.end())
+            g_state.shapes[it->second].bodies++;
+    }
+
+    static void evict_if_unused(const Shape* shape) {
+        auto it = g_state.shapeKeys.find(shape);
+        if (it == g_state.shapeKeys.end()) return;
+
+        auto cached = g_state.shapes.find(it->second);
+        if (cached->second.bodies > 0) return;
+
+        g_state.shapeKeys.erase(it);
+        g_state.shapes.erase(cached);
+    }
+
+    // the last body using it is gone, the cache lets go too
+    static void release_shape(const Shape* shape) {
+        auto it = g_state.shapeKeys.find(shape);
+        if (it == g_state.shapeKeys.end()) return;
+
+        CachedShape& cached = g_state.shapes[it->second];
+        if (cached.bodies > 0)
+            cached.bodies--;
+        evict_if_unused(shape);
+    }
+
+    // the filters read the matrix from the step's jobs, change it between steps
+    void set_layers_collide(uint8_t a, uint8_t b, bool collide) {
+        if (a >= g_state.layers.num_layers || b >= g_state.layers.num_layers) return;
+        g_state.layers.set_collides(a, b, collide);
+        rebuild_broad_phase_masks();
+    }
+
+    const Physics_Collision_Matrix& collision_matrix() {
+        return g_state.layers;
+    }
+
+    void set_event_mask(uint32_t mask) {
+        g_state.eventMask = mask & PHYSICS_EVENTS_ALL;
+    }
+
+    // the step joined every job before returning, their writes are visible here
+    void drain_events(std::vector<Physics_Event>& out) {
+        out.clear();
+
+        uint32_t threads = std::min(g_state.eventThreads.load(std::memory_order_relaxed), cMaxEventThreads);
+        size_t total = 0;
+        for (uint32_t i = 0; i < threads; i++)
+            total += g_state.eventBuffers[i].events.size();
+        out.reserve(total);
+
+        for (uint32_t i = 0; i < threads; i++) {
+            std::vector<Physics_Event>& events = g_state.eventBuffers[i].events;
+            out.insert(out.end(), events.begin(), events.end());
+            events.clear();
+        }
+
+        const BodyLockInterfaceNoLock& bodies = g_state.physicsSystem->GetBodyLockInterfaceNoLock();
+        for (Physics_Event& event : out) {
+            if (event.type != Physics_Event_Type::Contact_Removed) continue;
+
+            const Body* body1 = bodies.TryGetBody(event.body1);
+            const Body* body2 = bodies.TryGetBody(event.body2);
+            event.user_data1 = body1 ? body1->GetUserData() : 0;
+            event.user_data2 = body2 ? body2->GetUserData() : 0;
+        }
+
+        uint32_t dropped = g_state.droppedEvents.exchange(0, std::memory_order_relaxed);
+        if (dropped)
+            printf("[PHYSICS] dropped %u events, more than %u physics threads\n", dropped, cMaxEventThreads);
+    }
+
+    // read before the bodies are destroyed, no step may be running
+    static void release_body_shapes(const BodyID* ids, int count) {
+        const BodyLockInterfaceNoLock& bodies = g_state.physicsSystem->GetBodyLockInterfaceNoLock();
+        for (int i = 0; i < count; i++) {
+            const Body* body = bodies.TryGetBody(ids[i]);
+            if (body)
+                release_shape(body->GetShape());
         }
+    }
 
-        ObjectLayer layer = is_static ? Layers::NON_MOVING : Layers::MOVING;
+    // false for shapes we can not build
+    static bool make_body_settings(const Physics_Info& info, bool is_static, BodyCreationSettings& settings) {
+        RVec3 position(info.pos.x, info.pos.y, info.pos.z);
+        Quat rotation(info.orientation.w, info.orientation.x, info.orientation.y, info.orientation.z);
 
-        BodyCreationSettings settings(
+        EMotionType motion_type = is_static ? EMotionType::Static : EMotionType::Dynamic;
+        if (info.shape == Physics_Shape::Plane)
+            motion_type = EMotionType::Static;
+
+        RefConst<Shape> shape = acquire_shape(info, is_static);
+        if (!shape) return false;
+
+        uint8_t layer = info.layer;
+        if (layer == Physics_Layer::DEFAULT)
+            layer = is_static ? Physics_Layer::NON_MOVING : Physics_Layer::MOVING;
+        if (layer >= g_state.layers.num_layers) {
+            printf("[PHYSICS] layer %u is not in the collision matrix\n", layer);
+            return false;
+        }
+
+        settings = BodyCreationSettings(
             shape,
             position,
             rotation,
@@ -336,19 +928,72 @@ namespace Physics {
         // TODO physics material
         settings.mFriction = 0.5f;
         settings.mRestitution = 0.0f;
+        settings.mIsSensor = layer == Physics_Layer::TRIGGER;
 
         if (!is_static) {
             settings.mLinearDamping = 0.05f;
             settings.mAngularDamping = 0.05f;
         }
 
+        return true;
+    }
+
+    Physics_Handle add_object(const Physics_Info& info, bool is_static) {
+        BodyInterface& body_interface = g_state.physicsSystem->GetBodyInterface();
+
+        BodyCreationSettings settings;
+        if (!make_body_settings(info, is_static, settings)) {
+            assert(false);
+            return Physics_Handle{ 0 };
+        }
+
         Body* body = body_interface.CreateBody(settings);
+        retain_shape(settings.GetShape());
 
         body_interface.AddBody(body->GetID(), is_static ? EActivation::DontActivate : EActivation::Activate);
 
         return body->GetID();
     }
 
+    void add_objects(std::span<const Physics_Info> infos, bool is_static, std::span<Physics_Handle> out, std::span<const uint64_t> user_data) {
+        assert(out.size() >= infos.size());
+        BodyInterface& body_interface = g_state.physicsSystem->GetBodyInterface();
+
+        std::vector<BodyID> created;
+        created.reserve(infos.size());
+
+        for (size_t i = 0; i < infos.size(); i++) {
+            out[i] = BodyID();
+
+            BodyCreationSettings settings;
+            if (!make_body_settings(infos[i], is_static, settings)) continue;
+            if (i < user_data.size())
+                settings.mUserData = user_data[i];
+
+            // null once the body limit is reached
+            Body* body = body_interface.CreateBody(settings);
+            if (!body) {
+                evict_if_unused(settings.GetShape());
+                continue;
+            }
+            retain_shape(settings.GetShape());
+
+            out[i] = body->GetID();
+            created.push_back(body->GetID());
+        }
+
+        if (created.empty()) return;
+
+        // prepare sorts the ids, out keeps the caller's order
+        int count = static_cast<int>(created.size());
+        BodyInterface::AddState state = body_interface.AddBodiesPrepare(created.data(), count);
+        body_interface.AddBodiesFinalize(created.data(), count, state, is_static ? EActivation::DontActivate : EActivation::Activate);
+    }
+
+    void set_user_data(Physics_Handle handle, uint64_t user_data) {
+        g_state.physicsSystem->GetBodyInterface().SetUserData(handle, user_data);
+    }
+
     vec3 get_pos(Physics_Handle handle) {
         BodyInterface& body_interface = g_state.physicsSystem->GetBodyInterface();
         RVec3 pos = body_interface.GetPosition(handle);
@@ -370,6 +1015,27 @@ namespace Physics {
         return quat(rot.GetX(), rot.GetY(), rot.GetZ(), rot.GetW());
     }
 
+    void read_active_bodies(std::vector<Physics_Body_State>& out) {
+        out.clear();
+
+        g_state.physicsSystem->GetActiveBodies(EBodyType::RigidBody, g_state.activeBodies);
+        out.reserve(g_state.activeBodies.size());
+
+        const BodyLockInterfaceNoLock& bodies = g_state.physicsSystem->GetBodyLockInterfaceNoLock();
+        for (const BodyID& id : g_state.activeBodies) {
+            const Body* body = bodies.TryGetBody(id);
+            if (!body) continue;
+
+            RVec3 pos = body->GetPosition();
+            Quat rot = body->GetRotation();
+            out.push_back({
+                body->GetUserData(),
+                vec3(static_cast<float>(pos.GetX()), static_cast<float>(pos.GetY()), static_cast<float>(pos.GetZ())),
+                quat(rot.GetX(), rot.GetY(), rot.GetZ(), rot.GetW())
+            });
+        }
+    }
+
     // JPH::BodyID add_box(const glm::vec3& pos, const glm::vec3& size, bool isStatic) {
     //     // Create box shape
     //     RefConst<Shape> box_shape = new BoxShape(Vec3(size.x * 0.5f, size.y * 0.5f, size.z * 0.5f));
@@ -380,7 +1046,7 @@ namespace Physics {
 
     //     BodyCreationSettings body_settings(box_shape, RVec3(pos.x, pos.y, pos.z),
     //         Quat::sIdentity(), isStatic ? EMotionType::Static : EMotionType::Dynamic,
-    //         isStatic ? Layers::NON_MOVING : Layers::MOVING);
+    //         isStatic ? Physics_Layer::NON_MOVING : Physics_Layer::MOVING);
 
     //     body_settings.mRestitution = 0.2f;
 
@@ -398,7 +1064,7 @@ namespace Physics {
     //     // Create body creation settings
     //     BodyCreationSettings body_settings(sphere_shape, RVec3(pos.x, pos.y, pos.z),
     //         Quat::sIdentity(), isStatic ? EMotionType::Static : EMotionType::Dynamic,
-    //         isStatic ? Layers::NON_MOVING : Layers::MOVING);
+    //         isStatic ? Physics_Layer::NON_MOVING : Physics_Layer::MOVING);
 
     //     // Create body
     //     BodyInterface& body_interface = g_state.physicsSystem->GetBodyInterface();
@@ -409,10 +1075,92 @@ namespace Physics {
 
     void remove_body(JPH::BodyID id) {
         BodyInterface& body_interface = g_state.physicsSystem->GetBodyInterface();
+        release_body_shapes(&id, 1);
         body_interface.RemoveBody(id);
         body_interface.DestroyBody(id);
     }
 
+    void remove_bodies(std::span<const Physics_Handle> ids) {
+        BodyInterface& body_interface = g_state.physicsSystem->GetBodyInterface();
+
+        std::vector<BodyID> valid;
+        valid.reserve(ids.size());
+        for (const BodyID& id : ids) {
+            if (!id.IsInvalid())
+                valid.push_back(id);
+        }
+        if (valid.empty()) return;
+
+        int count = static_cast<int>(valid.size());
+        release_body_shapes(valid.data(), count);
+        body_interface.RemoveBodies(valid.data(), count);
+        body_interface.DestroyBodies(valid.data(), count);
+    }
+
+    void queue_remove_body(JPH::BodyID id) {
+        if (!id.IsInvalid())
+            g_state.pendingRemovals.push_back(id);
+    }
+
+    void set_state_ring(uint32_t ticks, size_t bytes_per_tick) {
+        g_state.stateRing.clear();
+        for (uint32_t i = 0; i < ticks; i++) {
+            auto& slot = g_state.stateRing.emplace_back(std::make_unique<RingStateRecorder>());
+            slot->data.reserve(bytes_per_tick);
+        }
+    }
+
+    static RingStateRecorder* state_slot(uint32_t tick) {
+        if (g_state.stateRing.empty()) return nullptr;
+        return g_state.stateRing[tick % g_state.stateRing.size()].get();
+    }
+
+    void save_state(uint32_t tick, std::span<const Physics_Handle> bodies) {
+        if (g_state.stateRing.empty())
+            set_state_ring(PHYSICS_STATE_TICKS, PHYSICS_STATE_BYTES);
+
+        RingStateRecorder* slot = state_slot(tick);
+        size_t capacity = slot->data.capacity();
+        slot->begin_write(tick);
+
+        slot->bodies.assign(bodies.begin(), bodies.end());
+        std::sort(slot->bodies.begin(), slot->bodies.end());
+
+        if (slot->bodies.empty()) {
+            g_state.physicsSystem->SaveState(*slot);
+        }
+        else {
+            BodySetFilter filter(slot->bodies);
+            g_state.physicsSystem->SaveState(*slot, EStateRecorderState::All, &filter);
+        }
+
+        if (slot->data.capacity() > capacity)
+            printf("[PHYSICS] State of tick %u grew its slot to %zu bytes, raise bytes_per_tick\n", tick, slot->data.capacity());
+    }
+
+    bool has_state(uint32_t tick) {
+        RingStateRecorder* slot = state_slot(tick);
+        return tick != 0 && slot && slot->tick == tick;
+    }
+
+    bool restore_state(uint32_t tick) {
+        if (!has_state(tick)) return false;
+
+        RingStateRecorder* slot = state_slot(tick);
+        slot->begin_read();
+
+        bool restored;
+        if (slot->bodies.empty()) {
+            restored = g_state.physicsSystem->RestoreState(*slot);
+        }
+        else {
+            BodySetFilter filter(slot->bodies);
+            restored = g_state.physicsSystem->RestoreState(*slot, &filter);
+        }
+
+        return restored && !slot->IsFailed();
+    }
+
     bool is_active(JPH::BodyID id) {
         BodyInterface& body_interface = g_state.physicsSystem->GetBodyInterface();
         return body_interface.IsActive(id);
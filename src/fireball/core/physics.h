@@ -1,5 +1,6 @@
 #pragma once
 
+#include "fireball/asset/model.h"
 #include "fireball/util/math.h"
 
 #include <Jolt/Jolt.h>
@@ -7,11 +8,17 @@
 #include <Jolt/Math/Vec3.h>
 #include <Jolt/Math/Quat.h>
 
+#include <algorithm>
+#include <cassert>
+#include <span>
+#include <string>
+#include <vector>
+
 namespace JPH {
     class BodyInterface;
     class PhysicsSystem;
     class TempAllocatorImpl;
-    class JobSystemThreadPool;
+    class JobSystem;
     class Body;
     class Shape;
     using BodyID = class BodyID;
@@ -19,13 +26,117 @@ namespace JPH {
 
 typedef JPH::BodyID Physics_Handle;
 
+struct Physics_Body_State {
+    uint64_t user_data; // set at creation, the scene stores the entity id
+    vec3 position;
+    quat orientation;
+};
+
+enum class Physics_Event_Type : uint8_t {
+    Contact_Added = 0,
+    Contact_Persisted,
+    Contact_Removed,
+    Activated,
+    Deactivated
+};
+
+// written by the physics threads while a step runs, read once it is over.
+// removed contacts and activations only know their bodies, the user data of
+// removed contacts is looked up when drained and is 0 for bodies that are gone
+struct Physics_Event {
+    Physics_Event_Type type;
+    Physics_Handle body1;
+    Physics_Handle body2; // invalid for activations
+    uint64_t user_data1 = 0;
+    uint64_t user_data2 = 0;
+
+    // contacts added or persisted only
+    vec3 point = vec3(0.0f);  // first contact point, on body1
+    vec3 normal = vec3(0.0f); // from body1 to body2
+    float impulse = 0.0f;     // estimated from the closing speed and masses, before the solver runs
+};
+
+// bit per Physics_Event_Type
+constexpr uint32_t PHYSICS_EVENTS_ALL = 0x1f;
+constexpr uint32_t PHYSICS_EVENTS_DEFAULT = PHYSICS_EVENTS_ALL & ~(1u << static_cast<uint32_t>(Physics_Event_Type::Contact_Persisted));
+
 enum class Physics_Shape {
     Box = 0,
     Sphere,
     Plane,
     Cylinder,
     Capsule,
-    Mesh
+    Mesh // client only, see Physics_Info::model
+};
+
+// object layers. every layer has a mask of the layers it collides with and
+// the broadphase tree it lives in, so triggers, characters, debris and static
+// geometry can be kept apart and queries only walk the trees they need.
+// games add their own from USER on, up to PHYSICS_MAX_LAYERS
+constexpr uint32_t PHYSICS_MAX_LAYERS = 32;
+constexpr uint32_t PHYSICS_MAX_BROAD_PHASE_LAYERS = 8;
+
+namespace Physics_Layer {
+    constexpr uint8_t NON_MOVING = 0;
+    constexpr uint8_t MOVING = 1;
+    constexpr uint8_t CHARACTER = 2;
+    constexpr uint8_t DEBRIS = 3;
+    constexpr uint8_t TRIGGER = 4; // bodies in it are sensors
+    constexpr uint8_t USER = 5;
+    // NON_MOVING for static bodies, MOVING otherwise
+    constexpr uint8_t DEFAULT = 0xff;
+}
+
+struct Physics_Collision_Matrix {
+    uint32_t num_layers = 0;
+    uint32_t num_broad_phase_layers = 0;
+    uint32_t collides[PHYSICS_MAX_LAYERS] = {}; // bit per layer, kept symmetric
+    uint8_t broad_phase[PHYSICS_MAX_LAYERS] = {};
+
+    // grows num_layers and num_broad_phase_layers to fit
+    void add_layer(uint8_t layer, uint8_t broad_phase_layer) {
+        assert(layer < PHYSICS_MAX_LAYERS && broad_phase_layer < PHYSICS_MAX_BROAD_PHASE_LAYERS);
+        broad_phase[layer] = broad_phase_layer;
+        num_layers = std::max<uint32_t>(num_layers, layer + 1);
+        num_broad_phase_layers = std::max<uint32_t>(num_broad_phase_layers, broad_phase_layer + 1);
+    }
+
+    void set_collides(uint8_t a, uint8_t b, bool collide = true) {
+        assert(a < PHYSICS_MAX_LAYERS && b < PHYSICS_MAX_LAYERS);
+        if (collide) {
+            collides[a] |= 1u << b;
+            collides[b] |= 1u << a;
+        } else {
+            collides[a] &= ~(1u << b);
+            collides[b] &= ~(1u << a);
+        }
+    }
+
+    bool should_collide(uint8_t a, uint8_t b) const {
+        return a < num_layers && b < num_layers && (collides[a] >> b & 1u);
+    }
+
+    // static, moving (with characters), debris and triggers each in their
+    // own tree. debris only lands on static geometry, triggers only see
+    // what moves
+    static Physics_Collision_Matrix defaults() {
+        Physics_Collision_Matrix m;
+        m.add_layer(Physics_Layer::NON_MOVING, 0);
+        m.add_layer(Physics_Layer::MOVING, 1);
+        m.add_layer(Physics_Layer::CHARACTER, 1);
+        m.add_layer(Physics_Layer::DEBRIS, 2);
+        m.add_layer(Physics_Layer::TRIGGER, 3);
+
+        m.set_collides(Physics_Layer::NON_MOVING, Physics_Layer::MOVING);
+        m.set_collides(Physics_Layer::NON_MOVING, Physics_Layer::CHARACTER);
+        m.set_collides(Physics_Layer::NON_MOVING, Physics_Layer::DEBRIS);
+        m.set_collides(Physics_Layer::MOVING, Physics_Layer::MOVING);
+        m.set_collides(Physics_Layer::MOVING, Physics_Layer::CHARACTER);
+        m.set_collides(Physics_Layer::CHARACTER, Physics_Layer::CHARACTER);
+        m.set_collides(Physics_Layer::TRIGGER, Physics_Layer::MOVING);
+        m.set_collides(Physics_Layer::TRIGGER, Physics_Layer::CHARACTER);
+        return m;
+    }
 };
 
 struct Physics_Info {
@@ -33,22 +144,88 @@ struct Physics_Info {
     vec3 pos;
     quat orientation;
     vec3 scale;
-    // stuff for mesh
+
+    // Mesh: cooked from the model's geometry at this lod, triangles for a
+    // static body, their convex hull for a dynamic one. the model has to be
+    // loaded, Scene holds the body back until it is. the server's headless
+    // Model_Manager never loads geometry, so there it is never made, give
+    // server bodies primitive shapes
+    Model_Handle model = {};
+    uint32_t lod = 0;
+
+    // one of Physics_Layer or a user layer in the collision matrix
+    uint8_t layer = Physics_Layer::DEFAULT;
 };
 
+// a quarter second at 128 Hz, slots grow past the byte estimate if they must
+constexpr uint32_t PHYSICS_STATE_TICKS = 32;
+constexpr size_t PHYSICS_STATE_BYTES = 1024 * 1024;
+
 namespace Physics {
-    bool init();
+    // the matrix is copied, layers and their broadphase trees are fixed from
+    // here on. which layers collide can still change
+    bool init(const Physics_Collision_Matrix& layers = Physics_Collision_Matrix::defaults());
+    // takes effect for new pairs, bodies already touching keep their contacts
+    // until they separate. only call it between steps, the filters read the
+    // matrix from the physics jobs without a lock
+    void set_layers_collide(uint8_t a, uint8_t b, bool collide);
+    const Physics_Collision_Matrix& collision_matrix();
     void shutdown();
     void update(float deltaTime = 1.0f / 60.0f);
+
+    // fixed step simulation. step() adds real time and runs as many whole
+    // steps as fit, at most max_steps per call, time beyond that is dropped
+    // instead of being caught up on next frame
+    void set_fixed_step(float step, uint32_t max_steps = 4, bool interpolate = true);
+    uint32_t step(float real_dt);
+    float fixed_step();
+    // how far the time not yet simulated is into the next step, 0..1.
+    // always 1 without interpolation, bodies are shown where they are
+    float alpha();
+    // steps run since init, bodies can only have moved when it changed
+    uint64_t step_count();
     void optimize_broad_phase();
+    // where cooked mesh shapes are kept between runs, "shape_cache/" by default
+    void set_shape_cache_dir(const std::string& dir);
 
     Physics_Handle add_object(const Physics_Info& physics_info, bool is_static = false);
+    // creates every body first and inserts them into the broadphase in one
+    // go, out gets the handles in info order, invalid where creation failed
+    void add_objects(std::span<const Physics_Info> infos, bool is_static, std::span<Physics_Handle> out, std::span<const uint64_t> user_data = {});
+    void set_user_data(Physics_Handle handle, uint64_t user_data);
 
     vec3 get_pos(Physics_Handle handle);
     vec3 get_rot(Physics_Handle handle);
     quat get_orientation(Physics_Handle handle);
 
+    // every body that is awake, read in one pass straight from the bodies
+    // without taking their locks, so never while a step runs. sleeping
+    // bodies have not moved since they were last awake
+    void read_active_bodies(std::vector<Physics_Body_State>& out);
+
     void remove_body(JPH::BodyID id);
+    void remove_bodies(std::span<const Physics_Handle> ids);
+    // removed together at the start of the next step
+    void queue_remove_body(JPH::BodyID id);
 
     bool is_active(JPH::BodyID id);
+
+    // contact and activation events. the listeners append to a buffer per
+    // physics thread without locking, drain_events moves everything since
+    // the last drain into out, in no particular order across threads.
+    // persisted contacts are one event per touching pair per step, so they
+    // are only recorded once enabled. call between steps
+    void set_event_mask(uint32_t mask);
+    void drain_events(std::vector<Physics_Event>& out);
+
+    // simulation state of the last ticks, for rewinding the world to a tick
+    // instead of simulating forward from scratch. slots are allocated up
+    // front, PHYSICS_STATE_TICKS of PHYSICS_STATE_BYTES unless set before the
+    // first save. bodies limits a save to those bodies and their contacts, a
+    // restore then only touches them. call between steps
+    void set_state_ring(uint32_t ticks, size_t bytes_per_tick);
+    void save_state(uint32_t tick, std::span<const Physics_Handle> bodies = {});
+    bool has_state(uint32_t tick);
+    // false if the tick fell out of the ring or the bodies it saved are gone
+    bool restore_state(uint32_t tick);
 }
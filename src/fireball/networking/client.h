@@ -2,10 +2,15 @@
 
 #include "networking.h"
 #include "network_protocol.h"
+#include "net_buffer.h"
+#include "net_thread.h"
+#include "transport.h"
 
 #include <steam/steamnetworkingsockets.h>
 #include <steam/isteamnetworkingutils.h>
 
+#include <memory>
+#include <span>
 #include <string>
 #include <functional>
 
@@ -13,57 +18,125 @@ class Client {
 public:
     std::function<void()> on_connected;
     std::function<void()> on_disconnected;
+    std::function<void(const Client_Accepted&)> on_accepted;
+    std::function<void(const Input_Ack&)> on_input_ack;
     std::function<void(const uint8_t*, size_t)> on_snapshot;
-
-    bool connect(const char* ip, uint16_t port, const std::string& name) {
-        // TODO make sure only called once
-        // and or deinit on loss of connection
-        InitSteamDatagramConnectionSockets();
+    // assets: the asset manifest that follows it, empty if the server sent none
+    std::function<void(const Snapshot_Manifest&, std::span<const uint8_t> assets)> on_snapshot_manifest;
+    std::function<void(const uint8_t*, size_t)> on_snapshot_chunk;
+    std::function<bool(const uint8_t*, size_t)> on_delta; // return true if applied, only then it gets acked
+    std::function<void(const uint8_t*, size_t)> on_entities_destroyed;
+    std::function<void(const Server_Stats&)> on_server_stats;
+
+    // threaded: socket io and callbacks run on their own Net_Thread, tick()
+    // then only handles what that thread queued up.
+    // transport: gns over udp when not given, a Loopback_Transport to join
+    // a server in the same process
+    bool connect(const char* ip, uint16_t port, const std::string& name, bool threaded = false, std::unique_ptr<Net_Transport> transport = nullptr) {
+        // TODO deinit on loss of connection
+        // a previous session's thread must not outlive the transport it uses
+        m_net.stop();
+        if (m_transport && m_conn != k_HSteamNetConnection_Invalid)
+            m_transport->close(m_conn, "Reconnecting", false);
+        m_conn = k_HSteamNetConnection_Invalid;
 
         m_name = name;
-        m_sockets = SteamNetworkingSockets();
 
-        SteamNetworkingIPAddr addr;
-        addr.Clear();
-        addr.ParseString(ip);
-        addr.m_port = port;
+        // the server may have restarted at a lower tick
+        m_last_delta_tick = 0;
+        m_bytes_received = 0;
+        m_transport = transport ? std::move(transport) : std::make_unique<Gns_Transport>();
 
-        SteamNetworkingConfigValue_t opt;
-        opt.SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged, (void*)connection_status_changed_static);
+        // runs inside run_callbacks, on the network thread when threaded
+        m_transport->on_status = [this](SteamNetConnectionStatusChangedCallback_t* info) {
+            if (m_net.running())
+                m_net.push_event(*info);
+            else
+                on_connection_status_changed(info);
+        };
 
-        m_conn = m_sockets->ConnectByIPAddress(addr, 1, &opt);
+        m_conn = m_transport->connect(ip, port);
         if (m_conn == k_HSteamNetConnection_Invalid) {
             printf("[CLIENT] Failed to connect to %s:%d\n", ip, port);
             return false;
         }
 
-        s_instance = this;
+        if (threaded)
+            m_net.start(m_transport.get());
         return true;
     }
 
     void disconnect() {
-        send_packet({ Net_Msg::ClientLeaving, {} });
-        m_sockets->CloseConnection(m_conn, 0, "Leaving", true);
-        // TODO disable steam datagram sockets
+        send_packet(Net_Msg::ClientLeaving, {});
+        m_net.stop(); // flushes the leave message
+        m_transport->close(m_conn, "Leaving", true);
+    }
+
+    // unreliable, the server only needs the latest one. also kept for the
+    // hello of the next connect
+    void send_viewpoint(float x, float y, float z) {
+        m_viewpoint[0] = x;
+        m_viewpoint[1] = y;
+        m_viewpoint[2] = z;
+        if (m_conn == k_HSteamNetConnection_Invalid) return;
+        send_struct(Net_Msg::ClientViewpoint, Client_Viewpoint { { x, y, z } }, k_nSteamNetworkingSend_UnreliableNoNagle);
+    }
+
+    // unreliable, every packet repeats the last few inputs
+    void send_input(const Client_Input& input) {
+        if (m_conn == k_HSteamNetConnection_Invalid) return;
+        send_struct(Net_Msg::ClientInput, input, k_nSteamNetworkingSend_UnreliableNoNagle);
+    }
+
+    void request_stats() {
+        if (m_conn == k_HSteamNetConnection_Invalid) return;
+        send_packet(Net_Msg::StatsRequest, {}, k_nSteamNetworkingSend_UnreliableNoNagle);
+    }
+
+    // everything received so far, headers included
+    uint64_t bytes_received() const { return m_bytes_received; }
+
+    // round trip as measured by the transport, -1 if not connected
+    int ping_ms() const {
+        if (m_conn == k_HSteamNetConnection_Invalid)
+            return -1;
+        return m_transport->ping_ms(m_conn);
     }
 
     void tick() {
-        if (m_conn != k_HSteamNetConnection_Invalid) {
+        if (m_conn == k_HSteamNetConnection_Invalid)
+            return;
+
+        if (m_net.running()) {
+            SteamNetConnectionStatusChangedCallback_t event;
+            while (m_net.pop_event(event))
+                on_connection_status_changed(&event);
+
+            SteamNetworkingMessage_t* msg;
+            while (m_net.pop_message(msg)) {
+                handle_message(static_cast<const uint8_t*>(msg->m_pData), msg->m_cbSize);
+                msg->Release();
+            }
+        }
+        else {
             poll_messages();
-            m_sockets->RunCallbacks();
+            m_transport->run_callbacks();
         }
     }
 
 private:
-    ISteamNetworkingSockets* m_sockets = nullptr;
+    std::unique_ptr<Net_Transport> m_transport;
     HSteamNetConnection m_conn    = k_HSteamNetConnection_Invalid;
     std::string m_name;
-    static Client* s_instance;
+    float m_viewpoint[3] = { 0.0f, 0.0f, 0.0f };
+    uint32_t m_last_delta_tick = 0;
+    uint64_t m_bytes_received = 0;
+    Net_Thread m_net; // after the transport so it stops first
 
     void poll_messages() {
         while (true) {
             ISteamNetworkingMessage* msg = nullptr;
-            int count = m_sockets->ReceiveMessagesOnConnection(m_conn, &msg, 1);
+            int count = m_transport->receive(&msg, 1);
             if (count <= 0) break;
 
             handle_message(static_cast<const uint8_t*>(msg->m_pData), msg->m_cbSize);
@@ -72,17 +145,20 @@ private:
     }
 
     void handle_message(const uint8_t* data, size_t size) {
-        NetPacket pkt;
-        if (!NetPacket::deserialize(data, size, pkt)) return;
+        m_bytes_received += size;
+
+        Packet_View pkt;
+        if (!Packet_View::parse(data, size, pkt)) return;
 
         switch (pkt.type) {
             case Net_Msg::ClientAccepted: {
 
                 Client_Accepted msg;
-                bool fail = NetPacket::to(pkt, msg);
+                bool fail = pkt.to(msg);
                 msg.server_name[sizeof(msg.server_name) - 1] = '\0';
 
                 printf("Connected to %s\nID %d, tickrate %d/s\n",msg.server_name, msg.your_id, msg.tick_rate);
+                if (on_accepted) on_accepted(msg);
 
                 break;
             }
@@ -94,8 +170,49 @@ private:
 
                 break;
 
-            case Net_Msg::DeltaUpdate:
-                // TODO: apply delta
+            case Net_Msg::SnapshotManifest: {
+                Snapshot_Manifest manifest;
+                if (pkt.to(manifest) && on_snapshot_manifest)
+                    on_snapshot_manifest(manifest, pkt.payload.subspan(sizeof(Snapshot_Manifest)));
+                break;
+            }
+
+            case Net_Msg::SnapshotChunk:
+                if (on_snapshot_chunk)
+                    on_snapshot_chunk(pkt.payload.data(), pkt.payload.size());
+                break;
+
+            case Net_Msg::DeltaUpdate: {
+                Delta_Header header;
+                if (!pkt.to(header)) break;
+
+                // unreliable, older deltas than what we have are useless
+                if (header.tick <= m_last_delta_tick) break;
+
+                if (on_delta && on_delta(pkt.payload.data(), pkt.payload.size())) {
+                    m_last_delta_tick = header.tick;
+                    send_struct(Net_Msg::SnapshotAck, Snapshot_Ack { header.tick }, k_nSteamNetworkingSend_UnreliableNoNagle);
+                }
+                break;
+            }
+
+            case Net_Msg::InputAck: {
+                Input_Ack ack;
+                if (pkt.to(ack) && on_input_ack)
+                    on_input_ack(ack);
+                break;
+            }
+
+            case Net_Msg::ServerStats: {
+                Server_Stats stats;
+                if (pkt.to(stats) && on_server_stats)
+                    on_server_stats(stats);
+                break;
+            }
+
+            case Net_Msg::EntityDestroyed:
+                if (on_entities_destroyed)
+                    on_entities_destroyed(pkt.payload.data(), pkt.payload.size());
                 break;
 
             case Net_Msg::ClientLeaving:
@@ -105,7 +222,7 @@ private:
                 
             case Net_Msg::ServerShutdown: {
                 Server_Shutdown s;
-                int fail = NetPacket::to(pkt, s);
+                int fail = pkt.to(s);
                 s.text[sizeof(s.text) - 1] = '\0';
                 
                 if (fail)
@@ -128,10 +245,10 @@ private:
             case k_ESteamNetworkingConnectionState_Connected: {
                 printf("[CLIENT] Connected, sending hello\n");
 
-                Client_Hello msg = { "fireball-client01" } ;
-                NetPacket hello = NetPacket::from(Net_Msg::ClientHello, msg);
-
-                send_packet(hello);
+                Client_Hello msg = {};
+                strncpy(msg.name, m_name.c_str(), sizeof(msg.name) - 1);
+                memcpy(msg.viewpoint, m_viewpoint, sizeof(msg.viewpoint));
+                send_struct(Net_Msg::ClientHello, msg);
 
                 if (on_connected)
                     on_connected();
@@ -149,14 +266,25 @@ private:
         }
     }
 
-    void send_packet(const NetPacket& pkt) {
-        auto buf = pkt.serialize();
-        m_sockets->SendMessageToConnection(m_conn, buf.data(), (uint32_t)buf.size(), k_nSteamNetworkingSend_Reliable, nullptr);
+    // the transport takes ownership of the message, buf keeps the caller's ref
+    void send_buffer(Net_Buffer* buf, int send_flags) {
+        SteamNetworkingMessage_t* msg = m_transport->make_message(buf, m_conn, send_flags);
+        if (m_net.running())
+            m_net.send(msg);
+        else
+            m_transport->send(&msg, 1);
     }
 
-    static void connection_status_changed_static(SteamNetConnectionStatusChangedCallback_t* info) {
-        s_instance->on_connection_status_changed(info);
+    void send_packet(Net_Msg type, std::span<const uint8_t> payload, int send_flags = k_nSteamNetworkingSend_Reliable) {
+        Net_Buffer* buf = frame_packet(type, payload);
+        send_buffer(buf, send_flags);
+        Net_Buffer_Pool::release(buf);
     }
-};
 
-inline Client* Client::s_instance = nullptr;
+    template<typename T>
+    void send_struct(Net_Msg type, const T& s, int send_flags = k_nSteamNetworkingSend_Reliable) {
+        Net_Buffer* buf = frame_struct(type, s);
+        send_buffer(buf, send_flags);
+        Net_Buffer_Pool::release(buf);
+    }
+};
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "transport.h"
+#include "net_queue.h"
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// in process transport, for a listen server and for running server and
+// bots in one process without the udp stack in the way. sending moves the
+// message itself into the peer's incoming queue, the payload is never
+// copied, nothing is lost or reordered and there is no ping. connection
+// status changes are made up to look like the gns ones Server and Client
+// already handle. nothing here calls into gns, it works without the library
+// initialized
+
+class Loopback_Transport;
+
+// messages are allocated here instead of by gns. pooled for the process, a
+// message is released by the transport it was delivered to, not its sender
+struct Loopback_Message : SteamNetworkingMessage_t {
+    static SteamNetworkingMessage_t* allocate() {
+        Pool& p = pool();
+        Loopback_Message* msg = nullptr;
+        {
+            std::lock_guard lock(p.mutex);
+            if (!p.free.empty()) {
+                msg = p.free.back();
+                p.free.pop_back();
+            }
+        }
+
+        if (msg) {
+            msg->~Loopback_Message();
+            new (msg) Loopback_Message();
+        }
+        else {
+            msg = new Loopback_Message();
+        }
+
+        msg->m_nConnUserData = -1;
+        msg->m_pfnRelease = release;
+        return msg;
+    }
+
+private:
+    // zeroed like a fresh gns message
+    Loopback_Message() : SteamNetworkingMessage_t() {}
+
+    struct Pool {
+        std::mutex mutex;
+        std::vector<Loopback_Message*> free;
+
+        ~Pool() {
+            for (Loopback_Message* msg : free)
+                delete msg;
+        }
+    };
+
+    static Pool& pool() {
+        static Pool p;
+        return p;
+    }
+
+    static void release(SteamNetworkingMessage_t* base) {
+        Loopback_Message* msg = static_cast<Loopback_Message*>(base);
+        if (msg->m_pfnFreeData)
+            msg->m_pfnFreeData(msg);
+
+        Pool& p = pool();
+        std::lock_guard lock(p.mutex);
+        p.free.push_back(msg);
+    }
+};
+
+// every loopback transport of the process, listeners by port
+class Loopback_Network {
+public:
+    static Loopback_Network& instance() {
+        static Loopback_Network network;
+        return network;
+    }
+
+private:
+    friend class Loopback_Transport;
+
+    struct Endpoint {
+        Loopback_Transport* owner;
+        HSteamNetConnection peer; // invalid once the peer closed
+    };
+
+    std::shared_mutex m_mutex; // exclusive to (dis)connect, shared to send
+    std::unordered_map<uint16_t, Loopback_Transport*> m_listeners;
+    std::unordered_map<HSteamNetConnection, Endpoint> m_endpoints;
+    HSteamNetConnection m_next_conn = 1;
+};
+
+class Loopback_Transport : public Net_Transport {
+public:
+    static constexpr size_t MAX_INCOMING = 8192;
+
+    explicit Loopback_Transport(Loopback_Network& network = Loopback_Network::instance())
+        : m_network(network) {}
+
+    ~Loopback_Transport() override {
+        {
+            std::unique_lock lock(m_network.m_mutex);
+            std::vector<HSteamNetConnection> own;
+            for (auto& [conn, endpoint] : m_network.m_endpoints) {
+                if (endpoint.owner == this)
+                    own.push_back(conn);
+            }
+            for (HSteamNetConnection conn : own)
+                disconnect_locked(conn, "Transport destroyed");
+
+            if (m_port && m_network.m_listeners[m_port] == this)
+                m_network.m_listeners.erase(m_port);
+        }
+
+        SteamNetworkingMessage_t* msg;
+        while (m_incoming->pop(msg))
+            msg->Release();
+        for (SteamNetworkingMessage_t* m : m_overflow)
+            m->Release();
+    }
+
+    bool listen(uint16_t port) override {
+        std::unique_lock lock(m_network.m_mutex);
+        auto [it, inserted] = m_network.m_listeners.try_emplace(port, this);
+        if (!inserted) return false;
+
+        m_port = port;
+        return true;
+    }
+
+    // ip is ignored, there is only this process
+    HSteamNetConnection connect(const char*, uint16_t port) override {
+        std::unique_lock lock(m_network.m_mutex);
+        auto it = m_network.m_listeners.find(port);
+        if (it == m_network.m_listeners.end())
+            return k_HSteamNetConnection_Invalid;
+
+        HSteamNetConnection local = m_network.m_next_conn++;
+        HSteamNetConnection remote = m_network.m_next_conn++;
+        m_network.m_endpoints[local] = { this, remote };
+        m_network.m_endpoints[remote] = { it->second, local };
+
+        it->second->push_status(remote, k_ESteamNetworkingConnectionState_Connecting, k_ESteamNetworkingConnectionState_None, "");
+        return local;
+    }
+
+    bool accept(HSteamNetConnection conn) override {
+        std::unique_lock lock(m_network.m_mutex);
+        auto it = m_network.m_endpoints.find(conn);
+        if (it == m_network.m_endpoints.end() || it->second.owner != this) return false;
+
+        auto peer = m_network.m_endpoints.find(it->second.peer);
+        if (peer == m_network.m_endpoints.end()) return false;
+
+        peer->second.owner->push_status(peer->first, k_ESteamNetworkingConnectionState_Connected, k_ESteamNetworkingConnectionState_Connecting, "");
+        return true;
+    }
+
+    // messages already sent are still delivered, so linger always holds
+    void close(HSteamNetConnection conn, const char* reason, bool) override {
+        std::unique_lock lock(m_network.m_mutex);
+        auto it = m_network.m_endpoints.find(conn);
+        if (it != m_network.m_endpoints.end() && it->second.owner == this)
+            disconnect_locked(conn, reason ? reason : "");
+    }
+
+    int receive(SteamNetworkingMessage_t** out, int max) override {
+        int count = 0;
+        while (count < max && m_incoming->pop(out[count]))
+            count++;
+
+        // the queue is empty when we get here with room left, so whatever
+        // overflowed is next in order
+        if (count < max && m_overflowing.load(std::memory_order_acquire)) {
+            std::lock_guard lock(m_overflow_mutex);
+            while (count < max && !m_overflow.empty()) {
+                out[count++] = m_overflow.front();
+                m_overflow.pop_front();
+            }
+            if (m_overflow.empty())
+                m_overflowing.store(false, std::memory_order_release);
+        }
+
+        return count;
+    }
+
+    void send(SteamNetworkingMessage_t* const* msgs, int count) override {
+        std::shared_lock lock(m_network.m_mutex);
+
+        for (int i = 0; i < count; i++) {
+            SteamNetworkingMessage_t* msg = msgs[i];
+
+            auto it = m_network.m_endpoints.find(msg->m_conn);
+            auto peer = it != m_network.m_endpoints.end() ? m_network.m_endpoints.find(it->second.peer) : m_network.m_endpoints.end();
+            if (peer == m_network.m_endpoints.end()) {
+                msg->Release(); // closed, gns drops these too
+                continue;
+            }
+
+            // the receiver sees it arrive on its end of the connection
+            msg->m_conn = peer->first;
+            msg->m_nConnUserData = -1;
+            peer->second.owner->deliver(msg);
+        }
+    }
+
+    void run_callbacks() override {
+        {
+            std::lock_guard lock(m_status_mutex);
+            if (m_status.empty()) return;
+            m_status_pending.swap(m_status);
+        }
+
+        // unlocked, handlers call back into accept and close
+        for (auto& event : m_status_pending) {
+            if (on_status)
+                on_status(&event);
+        }
+        m_status_pending.clear();
+    }
+
+    int pending_reliable(HSteamNetConnection) override { return 0; }
+    int ping_ms(HSteamNetConnection) override { return 0; }
+
+    SteamNetworkingMessage_t* allocate_message() override {
+        return Loopback_Message::allocate();
+    }
+
+    void shutdown() override {
+        std::unique_lock lock(m_network.m_mutex);
+        if (m_port && m_network.m_listeners[m_port] == this)
+            m_network.m_listeners.erase(m_port);
+        m_port = 0;
+    }
+
+private:
+    Loopback_Network& m_network;
+    uint16_t m_port = 0;
+
+    // large, kept off the stack and out of the owning object
+    std::unique_ptr<Mpsc_Queue<SteamNetworkingMessage_t*, MAX_INCOMING>> m_incoming = std::make_unique<Mpsc_Queue<SteamNetworkingMessage_t*, MAX_INCOMING>>();
+
+    // once the queue is full everything goes here until the receiver caught
+    // up, a connection only ever sends from one thread so it keeps its order
+    std::mutex m_overflow_mutex;
+    std::deque<SteamNetworkingMessage_t*> m_overflow;
+    std::atomic<bool> m_overflowing = false;
+
+    std::mutex m_status_mutex;
+    std::vector<SteamNetConnectionStatusChangedCallback_t> m_status;
+    std::vector<SteamNetConnectionStatusChangedCallback_t> m_status_pending;
+
+    void deliver(SteamNetworkingMessage_t* msg) {
+        if (!m_overflowing.load(std::memory_order_acquire) && m_incoming->push(msg))
+            return;
+
+        std::lock_guard lock(m_overflow_mutex);
+        m_overflow.push_back(msg);
+        m_overflowing.store(true, std::memory_order_release);
+    }
+
+    void push_status(HSteamNetConnection conn, ESteamNetworkingConnectionState state, ESteamNetworkingConnectionState old_state, const char* reason) {
+        SteamNetConnectionStatusChangedCallback_t event;
+        memset(&event, 0, sizeof(event));
+        event.m_hConn = conn;
+        event.m_eOldState = old_state;
+        event.m_info.m_eState = state;
+        event.m_info.m_nUserData = -1;
+        snprintf(event.m_info.m_szConnectionDescription, sizeof(event.m_info.m_szConnectionDescription), "loopback #%u", conn);
+        strncpy(event.m_info.m_szEndDebug, reason, sizeof(event.m_info.m_szEndDebug) - 1);
+
+        std::lock_guard lock(m_status_mutex);
+        m_status.push_back(event);
+    }
+
+    // m_network.m_mutex held exclusively
+    void disconnect_locked(HSteamNetConnection conn, const char* reason) {
+        auto it = m_network.m_endpoints.find(conn);
+        if (it == m_network.m_endpoints.end()) return;
+
+        auto peer = m_network.m_endpoints.find(it->second.peer);
+        if (peer != m_network.m_endpoints.end()) {
+            peer->second.peer = k_HSteamNetConnection_Invalid;
+            peer->second.owner->push_status(peer->first, k_ESteamNetworkingConnectionState_ClosedByPeer, k_ESteamNetworkingConnectionState_Connected, reason);
+        }
+
+        m_network.m_endpoints.erase(it);
+    }
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "network_protocol.h"
+
+#include <steam/steamnetworkingsockets.h>
+#include <steam/isteamnetworkingutils.h>
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <span>
+#include <vector>
+
+// pooled, refcounted send buffers
+// a frame (header + payload) is written once into a Net_Buffer and handed to
+// gns by pointing SteamNetworkingMessage_t::m_pData at it, so sends never
+// copy or allocate a payload. broadcasts wrap the same buffer in one message
+// per connection, every message holds a ref and the last release returns the
+// buffer to the pool. gns may release messages from its own thread
+
+struct alignas(16) Net_Buffer {
+    std::atomic<uint32_t> refs;
+    uint32_t size;     // bytes written
+    uint32_t capacity;
+    uint32_t bucket;
+
+    uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+
+    static Net_Buffer* from_data(void* data) {
+        return reinterpret_cast<Net_Buffer*>(data) - 1;
+    }
+};
+
+class Net_Buffer_Pool {
+public:
+    static constexpr uint32_t MIN_BUCKET_SIZE = 256;
+    static constexpr uint32_t NUM_BUCKETS = 13; // 256b .. 1mb, bigger is not pooled
+    static constexpr uint32_t MAX_FREE_PER_BUCKET = 256;
+
+    // returned buffer holds one ref
+    static Net_Buffer* acquire(uint32_t size) {
+        uint32_t bucket = bucket_for(size);
+
+        if (bucket < NUM_BUCKETS) {
+            std::lock_guard lock(s_mutex);
+            auto& free = s_free[bucket];
+            if (!free.empty()) {
+                Net_Buffer* buf = free.back();
+                free.pop_back();
+                buf->refs.store(1, std::memory_order_relaxed);
+                buf->size = 0;
+                return buf;
+            }
+        }
+
+        uint32_t capacity = bucket < NUM_BUCKETS ? MIN_BUCKET_SIZE << bucket : size;
+        void* mem = ::operator new(sizeof(Net_Buffer) + capacity, std::align_val_t(alignof(Net_Buffer)));
+        Net_Buffer* buf = new (mem) Net_Buffer;
+        buf->refs.store(1, std::memory_order_relaxed);
+        buf->size = 0;
+        buf->capacity = capacity;
+        buf->bucket = bucket;
+        return buf;
+    }
+
+    static void add_ref(Net_Buffer* buf) {
+        buf->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void release(Net_Buffer* buf) {
+        if (buf->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        if (buf->bucket < NUM_BUCKETS) {
+            std::lock_guard lock(s_mutex);
+            auto& free = s_free[buf->bucket];
+            if (free.size() < MAX_FREE_PER_BUCKET) {
+                free.push_back(buf);
+                return;
+            }
+        }
+
+        buf->~Net_Buffer();
+        ::operator delete(buf, std::align_val_t(alignof(Net_Buffer)));
+    }
+
+private:
+    static uint32_t bucket_for(uint32_t size) {
+        if (size <= MIN_BUCKET_SIZE) return 0;
+        return std::bit_width(size - 1) - std::bit_width(MIN_BUCKET_SIZE - 1);
+    }
+
+    static inline std::mutex s_mutex;
+    static inline std::vector<Net_Buffer*> s_free[NUM_BUCKETS];
+};
+
+// [uint8 Net_Msg][uint32 payload_len][payload]
+// the header only, the caller writes size bytes of payload after NET_HEADER_SIZE
+static Net_Buffer* begin_frame(Net_Msg type, uint32_t size) {
+    Net_Buffer* buf = Net_Buffer_Pool::acquire(NET_HEADER_SIZE + size);
+    uint8_t* out = buf->data();
+
+    out[0] = static_cast<uint8_t>(type);
+    memcpy(out + 1, &size, sizeof(uint32_t));
+
+    buf->size = NET_HEADER_SIZE + size;
+    return buf;
+}
+
+static Net_Buffer* frame_packet(Net_Msg type, const void* payload, uint32_t size) {
+    Net_Buffer* buf = begin_frame(type, size);
+    if (size)
+        memcpy(buf->data() + NET_HEADER_SIZE, payload, size);
+    return buf;
+}
+
+static Net_Buffer* frame_packet(Net_Msg type, std::span<const uint8_t> payload) {
+    return frame_packet(type, payload.data(), static_cast<uint32_t>(payload.size()));
+}
+
+// simple serialization of single, constant sized, structs
+template<typename T>
+static Net_Buffer* frame_struct(Net_Msg type, const T& s) {
+    return frame_packet(type, &s, sizeof(T));
+}
+
+// a full snapshot ready to stream
+struct Snapshot_Stream {
+    Snapshot_Manifest manifest {};
+    std::vector<Net_Buffer*> chunks; // framed SnapshotChunk packets, a ref each for whoever sends them
+    std::vector<uint8_t> assets; // asset manifest, may be empty
+};
+
+// for streams that are not sent
+static void release_chunks(Snapshot_Stream& stream) {
+    for (Net_Buffer* chunk : stream.chunks)
+        Net_Buffer_Pool::release(chunk);
+    stream.chunks.clear();
+}
+
+static void free_message_data(SteamNetworkingMessage_t* msg) {
+    Net_Buffer_Pool::release(Net_Buffer::from_data(msg->m_pData));
+}
+
+// the message takes its own ref on buf. msg comes from the transport it is sent on
+static SteamNetworkingMessage_t* make_message(SteamNetworkingMessage_t* msg, Net_Buffer* buf, HSteamNetConnection conn, int send_flags) {
+    msg->m_pData = buf->data();
+    msg->m_cbSize = static_cast<int>(buf->size);
+    msg->m_conn = conn;
+    msg->m_nFlags = send_flags;
+    msg->m_pfnFreeData = free_message_data;
+
+    Net_Buffer_Pool::add_ref(buf);
+    return msg;
+}
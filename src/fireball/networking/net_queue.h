@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+// bounded lock-free queues between the network thread and the simulation
+// capacity has to be a power of two, push fails instead of blocking when full
+
+constexpr size_t NET_CACHE_LINE = 64;
+
+// single producer, single consumer
+template<typename T, size_t Capacity>
+class Spsc_Queue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    bool push(const T& v) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head_cache == Capacity) {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail - m_head_cache == Capacity)
+                return false;
+        }
+
+        m_slots[tail & (Capacity - 1)] = v;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail_cache) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tail_cache)
+                return false;
+        }
+
+        out = m_slots[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // producer side, may be stale low
+    size_t free_space() const {
+        return Capacity - (m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire));
+    }
+
+private:
+    alignas(NET_CACHE_LINE) std::atomic<size_t> m_head { 0 };
+    size_t m_tail_cache = 0; // consumer's view of tail
+    alignas(NET_CACHE_LINE) std::atomic<size_t> m_tail { 0 };
+    size_t m_head_cache = 0; // producer's view of head
+    alignas(NET_CACHE_LINE) T m_slots[Capacity];
+};
+
+// multiple producers, single consumer. every slot carries a sequence
+// number so producers claim slots with one cas and publish independently
+template<typename T, size_t Capacity>
+class Mpsc_Queue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    Mpsc_Queue() {
+        for (size_t i = 0; i < Capacity; i++)
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(const T& v) {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        Slot* slot;
+
+        while (true) {
+            slot = &m_slots[pos & (Capacity - 1)];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                return false; // full
+            }
+            else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = v;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out) {
+        Slot& slot = m_slots[m_head & (Capacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != m_head + 1)
+            return false;
+
+        out = slot.value;
+        slot.sequence.store(m_head + Capacity, std::memory_order_release);
+        m_head++;
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    alignas(NET_CACHE_LINE) std::atomic<size_t> m_tail { 0 };
+    alignas(NET_CACHE_LINE) size_t m_head = 0; // consumer only
+    alignas(NET_CACHE_LINE) Slot m_slots[Capacity];
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "net_queue.h"
+#include "transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+// optional network thread for Server and Client
+// the thread owns receiving, sending and RunCallbacks. received messages and
+// connection status changes are handed to the simulation through queues and
+// released there, outgoing messages come back through an mpsc queue so
+// a slow SendMessages never stalls the tick and a slow tick never delays the
+// socket. when a queue is full the thread stops receiving until there is
+// room, the transport keeps buffering in the meantime
+
+class Net_Thread {
+public:
+    static constexpr size_t MAX_INCOMING = 4096;
+    static constexpr size_t MAX_EVENTS = 256;
+    static constexpr size_t MAX_OUTGOING = 8192;
+    static constexpr int BATCH = 64;
+
+    std::chrono::microseconds idle_sleep { 250 };
+
+    ~Net_Thread() {
+        stop();
+    }
+
+    void start(Net_Transport* transport) {
+        if (m_running) return;
+
+        m_transport = transport;
+        m_running = true;
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    // sends what is still queued, received messages left over are released
+    void stop() {
+        if (!m_running) return;
+
+        m_running = false;
+        if (m_thread.joinable())
+            m_thread.join();
+
+        flush_outgoing();
+
+        SteamNetworkingMessage_t* msg;
+        while (m_incoming->pop(msg))
+            msg->Release();
+    }
+
+    bool running() const { return m_running; }
+
+    // simulation side, the caller releases the message
+    bool pop_message(SteamNetworkingMessage_t*& msg) {
+        return m_incoming->pop(msg);
+    }
+
+    bool pop_event(SteamNetConnectionStatusChangedCallback_t& event) {
+        return m_events->pop(event);
+    }
+
+    // any thread, the transport owns the message afterwards either way
+    void send(SteamNetworkingMessage_t* msg) {
+        if (!m_outgoing->push(msg))
+            m_transport->send(&msg, 1); // full, send from here
+    }
+
+    // called from the status changed callback, which runs on the network thread
+    void push_event(const SteamNetConnectionStatusChangedCallback_t& event) {
+        // never dropped, the simulation would lose track of the connection
+        while (!m_events->push(event))
+            std::this_thread::yield();
+    }
+
+private:
+    Net_Transport* m_transport = nullptr;
+    std::atomic<bool> m_running = false;
+    std::thread m_thread;
+
+    // large, kept off the stack and out of the owning object
+    std::unique_ptr<Spsc_Queue<SteamNetworkingMessage_t*, MAX_INCOMING>> m_incoming = std::make_unique<Spsc_Queue<SteamNetworkingMessage_t*, MAX_INCOMING>>();
+    // mpsc, with several clients in one process any of their threads may run the callback
+    std::unique_ptr<Mpsc_Queue<SteamNetConnectionStatusChangedCallback_t, MAX_EVENTS>> m_events = std::make_unique<Mpsc_Queue<SteamNetConnectionStatusChangedCallback_t, MAX_EVENTS>>();
+    std::unique_ptr<Mpsc_Queue<SteamNetworkingMessage_t*, MAX_OUTGOING>> m_outgoing = std::make_unique<Mpsc_Queue<SteamNetworkingMessage_t*, MAX_OUTGOING>>();
+
+    // returns how many messages were sent
+    int flush_outgoing() {
+        SteamNetworkingMessage_t* batch[BATCH];
+        int total = 0;
+
+        while (true) {
+            int count = 0;
+            while (count < BATCH && m_outgoing->pop(batch[count]))
+                count++;
+            if (count == 0) break;
+
+            m_transport->send(batch, count);
+            total += count;
+        }
+
+        return total;
+    }
+
+    void run() {
+        SteamNetworkingMessage_t* batch[BATCH];
+
+        while (m_running) {
+            bool busy = flush_outgoing() > 0;
+
+            int room = static_cast<int>(std::min<size_t>(m_incoming->free_space(), BATCH));
+            if (room > 0) {
+                int count = m_transport->receive(batch, room);
+                for (int i = 0; i < count; i++)
+                    m_incoming->push(batch[i]);
+                busy |= count > 0;
+            }
+
+            m_transport->run_callbacks();
+
+            if (!busy)
+                std::this_thread::sleep_for(idle_sleep);
+        }
+    }
+};
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <cstring>
+#include <span>
 #include <vector>
 
 // TODO network structures and settings
@@ -13,12 +14,94 @@ struct Client_Accepted {
 
 struct Client_Hello {
     char name[32];
+    float viewpoint[3]; // the join snapshot is built around it
 };
 
 struct Server_Shutdown {
     char text[1024];
 };
 
+// leads every DeltaUpdate payload, baseline_tick 0 means delta'd against nothing
+struct Delta_Header {
+    uint32_t tick;
+    uint32_t baseline_tick;
+};
+
+struct Snapshot_Ack {
+    uint32_t tick;
+};
+
+// where the client is looking from, drives which entities it is sent
+struct Client_Viewpoint {
+    float position[3];
+};
+
+// leads every EntityDestroyed payload, followed by count uint64 entity ids
+struct Entity_Destroyed_Header {
+    uint32_t tick;
+    uint32_t count;
+};
+
+// one fixed step of player input, tick is the client's own input tick
+enum Input_Button : uint8_t {
+    Input_Jump = 1 << 0,
+};
+
+struct Input_Command {
+    uint32_t tick;
+    int8_t move_x;  // -127..127, right
+    int8_t move_z;  // -127..127, forward
+    uint8_t buttons;
+    uint8_t pad;
+    float yaw;      // radians, forward is rotated by this around y
+};
+
+// ClientInput payload, the newest inputs oldest first. each is sent in
+// INPUT_REDUNDANCY packets so single losses never reach the server
+constexpr uint32_t INPUT_REDUNDANCY = 8;
+
+struct Client_Input {
+    uint32_t count;
+    Input_Command commands[INPUT_REDUNDANCY];
+};
+
+// authoritative state of the client's player after its input tick ran on the server
+struct Input_Ack {
+    uint32_t input_tick;
+    uint32_t pad;
+    uint64_t entity_id;
+    float position[3];
+    float velocity[3];
+};
+
+// full snapshots are streamed as a SnapshotManifest followed by chunk_count
+// SnapshotChunks, each holding whole entities with parents before children.
+// the SnapshotManifest payload continues with the asset manifest
+struct Snapshot_Manifest {
+    uint32_t entity_count;
+    uint32_t total_bytes; // sum of all chunk payloads
+    uint32_t chunk_count;
+    uint32_t tick; // snapshot the stream was written from, baseline of the first delta. 0 if none
+};
+
+// leads every SnapshotChunk payload, followed by entity_count [uint32 size][entity]
+struct Snapshot_Chunk_Header {
+    uint32_t index;
+    uint32_t entity_count;
+};
+
+// reply to StatsRequest, tick timings of the last Tick_Telemetry window
+struct Server_Stats {
+    uint32_t tick_rate;
+    uint32_t clients;
+    uint64_t ticks;
+    uint64_t overruns;
+    float tick_p50_ms;
+    float tick_p99_ms;
+    float tick_max_ms;
+    float budget_ms;
+};
+
 enum class Net_Msg : uint8_t {
     // Server -> Client
     FullSnapshot    = 1,
@@ -26,50 +109,42 @@ enum class Net_Msg : uint8_t {
     EntityDestroyed = 3,
     ClientAccepted  = 4,
     ServerShutdown = 5,
+    InputAck        = 6,
+    SnapshotManifest = 7,
+    SnapshotChunk   = 8,
+    ServerStats     = 9,
 
     // Client -> Server
     ClientHello     = 10,
     ClientInput     = 11,
     ClientLeaving   = 12,
+    SnapshotAck     = 13,
+    ClientViewpoint = 14,
+    StatsRequest    = 15,
 };
 
-struct NetPacket {
+constexpr uint32_t NET_HEADER_SIZE = 5; // [uint8 Net_Msg][uint32 payload_len]
+
+// read only view of a received packet, the payload points into the
+// received message and is only valid until it is released
+struct Packet_View {
     Net_Msg type;
-    std::vector<uint8_t> payload;
-
-    std::vector<uint8_t> serialize() const {
-        std::vector<uint8_t> out; // make sizeof payload maybe or stack buffer
-        out.push_back(static_cast<uint8_t>(type));
-        uint32_t len = static_cast<uint32_t>(payload.size());
-        out.insert(out.end(), reinterpret_cast<uint8_t*>(&len),
-                              reinterpret_cast<uint8_t*>(&len) + 4);
-        out.insert(out.end(), payload.begin(), payload.end());
-        return out;
-    }
+    std::span<const uint8_t> payload;
 
-    static bool deserialize(const uint8_t* data, size_t size, NetPacket& out) {
-        if (size < 5) return false;
+    static bool parse(const uint8_t* data, size_t size, Packet_View& out) {
+        if (size < NET_HEADER_SIZE) return false;
         out.type = static_cast<Net_Msg>(data[0]);
         uint32_t len;
         memcpy(&len, data + 1, 4);
-        if (size < 5 + len) return false;
-        out.payload.assign(data + 5, data + 5 + len);
+        if (size - NET_HEADER_SIZE < len) return false;
+        out.payload = { data + NET_HEADER_SIZE, len };
         return true;
     }
 
-    // simple serialization of single, constant sized,
-    // structs based on msg type
-    template<typename T>
-    static NetPacket from(Net_Msg type, const T& s) {
-        std::vector<uint8_t> payload(sizeof(T));
-        memcpy(payload.data(), &s, sizeof(T));
-        return { type, payload };
-    }
-
     template<typename T>
-    static bool to(const NetPacket& pkt, T& out) {
-        if (pkt.payload.size() < sizeof(T)) return false;
-        memcpy(&out, pkt.payload.data(), sizeof(T));
+    bool to(T& out) const {
+        if (payload.size() < sizeof(T)) return false;
+        memcpy(&out, payload.data(), sizeof(T));
         return true;
     }
 };
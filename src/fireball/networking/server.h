@@ -2,18 +2,35 @@
 
 #include "networking.h"
 #include "network_protocol.h"
+#include "net_buffer.h"
+#include "net_thread.h"
+#include "transport.h"
 
 #include <steam/steamnetworkingsockets.h>
 #include <steam/isteamnetworkingutils.h>
 
+#include <algorithm>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <span>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <string>
 
 struct ClientState {
     HSteamNetConnection conn;
     bool fully_loaded = false; // received snapshot and acked
+    uint32_t last_acked_tick = 0; // newest delta the client applied, baseline for the next one
+    uint32_t stream_tick = 0;     // snapshot the join stream was written from, the first baseline
+    float viewpoint[3] = { 0.0f, 0.0f, 0.0f }; // last reported Client_Viewpoint
+    std::deque<Input_Command> inputs; // received, not yet simulated, ascending ticks
+    uint32_t last_input_tick = 0;      // newest input ever queued
+
+    // framed SnapshotManifest + SnapshotChunks still to send, each holds a ref
+    std::vector<Net_Buffer*> stream;
+    size_t stream_next = 0;
     std::string name;
 };
 
@@ -22,33 +39,49 @@ public:
     // todo change to virtual functions with force override?
     // virtual f() = 0; for core functions that require implementation
     // can leave non core stuff optional, i.e. chat, voice, etc.
-    std::function<std::vector<uint8_t>()> on_full_snapshot;
-    std::function<std::vector<uint8_t>()> on_delta_update; 
+    std::function<Snapshot_Stream(const ClientState&)> on_full_snapshot;
+    // the client's DeltaUpdate framed into a pool buffer, returned with a ref
+    // that broadcast_delta releases, nullptr to send nothing. clients that
+    // get the same bytes should get the same buffer, with a ref each
+    std::function<Net_Buffer*(const ClientState&)> on_delta_update;
+    uint32_t tick_rate = 128; // advertised to clients, the game loop is expected to run at it
+
+    // full snapshots are streamed to joining clients in chunks, paced so a
+    // big join does not crowd out the deltas of everyone else
+    uint32_t snapshot_chunk_size = 16 * 1024;
+    uint32_t stream_bytes_per_tick = 64 * 1024;   // across all joining clients
+    uint32_t stream_max_pending = 256 * 1024;     // reliable bytes queued in the transport per connection
     std::function<void(HSteamNetConnection, const std::string&)> on_client_joined;
     std::function<void(HSteamNetConnection)> on_client_left;
-    std::function<void(HSteamNetConnection, const uint8_t*, size_t)> on_client_input;
-
-    bool start(uint16_t port) {
-        InitSteamDatagramConnectionSockets();
-
-        m_sockets = SteamNetworkingSockets();
-
-        SteamNetworkingIPAddr addr;
-        addr.Clear();
-        addr.m_port = port;
-
-        SteamNetworkingConfigValue_t opt;
-        opt.SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged, (void*)connection_status_changed_static);
-
-        m_listen_socket = m_sockets->CreateListenSocketIP(addr, 1, &opt);
-        if (m_listen_socket == k_HSteamListenSocket_Invalid) {
+    std::function<Server_Stats()> on_stats_request;
+
+    // inputs buffered beyond this are dropped oldest first, the client is too far ahead
+    static constexpr size_t MAX_QUEUED_INPUTS = 32;
+
+    // threaded: socket io and callbacks run on their own Net_Thread, tick()
+    // then only handles what that thread queued up.
+    // transport: gns over udp when not given, a Loopback_Transport for a
+    // server living in the same process as its clients
+    bool start(uint16_t port, bool threaded = false, std::unique_ptr<Net_Transport> transport = nullptr) {
+        m_transport = transport ? std::move(transport) : std::make_unique<Gns_Transport>();
+
+        // runs inside run_callbacks, on the network thread when threaded
+        m_transport->on_status = [this](SteamNetConnectionStatusChangedCallback_t* info) {
+            if (m_net.running())
+                m_net.push_event(*info);
+            else
+                on_connection_status_changed(info);
+        };
+
+        if (!m_transport->listen(port)) {
             Printf("Failed to create listen socket on port %d", port);
             return false;
         }
 
-        m_poll_group = m_sockets->CreatePollGroup();
         Printf("Server listening on port %d", port);
-        s_instance = this;
+
+        if (threaded)
+            m_net.start(m_transport.get());
         return true;
     }
 
@@ -58,55 +91,111 @@ public:
             Server_Shutdown shutdown {
                 .text = "Server shutdown, reason 12345"
             };
-            send_packet(conn, NetPacket::from(Net_Msg::ServerShutdown,  shutdown));
-            m_sockets->CloseConnection(conn, 0, "Server shutdown", true);
+            send_struct(conn, Net_Msg::ServerShutdown, shutdown);
+            release_stream(state);
         }
 
+        // flushes the shutdown messages before the connections close
+        m_net.stop();
+
+        for (auto& [conn, state] : m_clients)
+            m_transport->close(conn, "Server shutdown", true);
+
         m_clients.clear();
-        m_sockets->CloseListenSocket(m_listen_socket);
-        m_sockets->DestroyPollGroup(m_poll_group);
-        ShutdownSteamDatagramConnectionSockets();
+        m_transport->shutdown();
     }
 
     void tick() {
-        poll_messages();
-        poll_connection_state_changes();
+        if (m_net.running()) {
+            drain_net_thread();
+        }
+        else {
+            poll_messages();
+            poll_connection_state_changes();
+        }
+        pump_streams();
     }
 
+    // every client gets a delta against the last snapshot it acked,
+    // unreliable since a lost delta is superseded by the next one. whatever
+    // on_delta_update queues with queue_to goes out in the same batch
     void broadcast_delta() {
         if (!on_delta_update) return;
-        auto delta = on_delta_update();
-        if (delta.empty()) return;
 
-        NetPacket pkt { Net_Msg::DeltaUpdate, delta };
+        for (auto& [conn, state] : m_clients) {
+            if (!state.fully_loaded) continue;
+
+            Net_Buffer* buf = on_delta_update(state);
+            if (!buf) continue;
+
+            m_outgoing.push_back(m_transport->make_message(buf, conn, k_nSteamNetworkingSend_UnreliableNoNagle));
+            Net_Buffer_Pool::release(buf);
+        }
+
+        flush_outgoing();
+    }
+
+    // same payload to every loaded client, framed once
+    void broadcast(Net_Msg type, std::span<const uint8_t> payload, int send_flags = k_nSteamNetworkingSend_Reliable) {
+        Net_Buffer* buf = frame_packet(type, payload);
         for (auto& [conn, state] : m_clients) {
             if (state.fully_loaded)
-                send_packet(conn, pkt);
+                m_outgoing.push_back(m_transport->make_message(buf, conn, send_flags));
         }
+        flush_outgoing();
+        Net_Buffer_Pool::release(buf);
     }
 
-    void send_to(HSteamNetConnection conn, const NetPacket& pkt) {
-        send_packet(conn, pkt);
+    // sent with the next batch instead of on its own
+    void queue_to(HSteamNetConnection conn, Net_Msg type, std::span<const uint8_t> payload, int send_flags = k_nSteamNetworkingSend_Reliable) {
+        Net_Buffer* buf = frame_packet(type, payload);
+        m_outgoing.push_back(m_transport->make_message(buf, conn, send_flags));
+        Net_Buffer_Pool::release(buf);
+    }
+
+    void send_to(HSteamNetConnection conn, Net_Msg type, std::span<const uint8_t> payload, int send_flags = k_nSteamNetworkingSend_Reliable) {
+        Net_Buffer* buf = frame_packet(type, payload);
+        send_buffer(conn, buf, send_flags);
+        Net_Buffer_Pool::release(buf);
+    }
+
+    template<typename T>
+    void send_struct(HSteamNetConnection conn, Net_Msg type, const T& s, int send_flags = k_nSteamNetworkingSend_Reliable) {
+        Net_Buffer* buf = frame_struct(type, s);
+        send_buffer(conn, buf, send_flags);
+        Net_Buffer_Pool::release(buf);
     }
 
     void kick(HSteamNetConnection conn, const char* reason = "Kicked") {
-        m_sockets->CloseConnection(conn, 0, reason, false);
+        m_transport->close(conn, reason, false);
     }
 
     size_t client_count() const { return m_clients.size(); }
 
+    // next input of conn to simulate this fixed step, false if none arrived in time
+    bool pop_input(HSteamNetConnection conn, Input_Command& out) {
+        auto it = m_clients.find(conn);
+        if (it == m_clients.end() || it->second.inputs.empty()) return false;
+
+        out = it->second.inputs.front();
+        it->second.inputs.pop_front();
+        return true;
+    }
+
 private:
-    ISteamNetworkingSockets* m_sockets     = nullptr;
-    HSteamListenSocket m_listen_socket = k_HSteamListenSocket_Invalid;
-    HSteamNetPollGroup m_poll_group  = k_HSteamNetPollGroup_Invalid;
+    std::unique_ptr<Net_Transport> m_transport;
     std::unordered_map<HSteamNetConnection, ClientState> m_clients;
 
-    static Server* s_instance;
+    // reused every tick so sending does not allocate once warm
+    std::vector<SteamNetworkingMessage_t*> m_outgoing;
+
+    // declared after the transport so it stops before the transport goes away
+    Net_Thread m_net;
 
     void poll_messages() {
         while (true) {
             ISteamNetworkingMessage* msg = nullptr;
-            int count = m_sockets->ReceiveMessagesOnPollGroup(m_poll_group, &msg, 1);
+            int count = m_transport->receive(&msg, 1);
             if (count <= 0) break;
 
             handle_message(msg->m_conn, static_cast<const uint8_t*>(msg->m_pData), msg->m_cbSize);
@@ -115,12 +204,24 @@ private:
     }
 
     void poll_connection_state_changes() {
-        m_sockets->RunCallbacks();
+        m_transport->run_callbacks();
+    }
+
+    void drain_net_thread() {
+        SteamNetConnectionStatusChangedCallback_t event;
+        while (m_net.pop_event(event))
+            on_connection_status_changed(&event);
+
+        SteamNetworkingMessage_t* msg;
+        while (m_net.pop_message(msg)) {
+            handle_message(msg->m_conn, static_cast<const uint8_t*>(msg->m_pData), msg->m_cbSize);
+            msg->Release();
+        }
     }
 
     void handle_message(HSteamNetConnection conn, const uint8_t* data, size_t size) {
-        NetPacket pkt;
-        if (!NetPacket::deserialize(data, size, pkt)) {
+        Packet_View pkt;
+        if (!Packet_View::parse(data, size, pkt)) {
             Printf("Malformed packet from connection %u", conn);
             return;
         }
@@ -128,40 +229,92 @@ private:
         switch (pkt.type) {
             case Net_Msg::ClientHello: {
                 Client_Hello msg;
-                bool fail = NetPacket::to(pkt, msg);
+                bool fail = pkt.to(msg);
                 msg.name[sizeof(msg.name) - 1] = '\0';
 
                 printf("Client %s joined\n", msg.name);
 
                 auto& state = m_clients[conn];
                 state.name = std::string(msg.name);
+                memcpy(state.viewpoint, msg.viewpoint, sizeof(state.viewpoint));
 
-                Client_Accepted sinfo { .server_name = "fireball-server", .your_id = conn, .tick_rate = 128 }; // todo change tickrate to setting
-                NetPacket packet = NetPacket::from(Net_Msg::ClientAccepted, sinfo);
-                send_packet(conn, packet, k_nSteamNetworkingSend_Reliable);
+                Client_Accepted sinfo { .server_name = "fireball-server", .your_id = conn, .tick_rate = tick_rate };
+                send_struct(conn, Net_Msg::ClientAccepted, sinfo, k_nSteamNetworkingSend_Reliable);
 
                 if (on_full_snapshot) {
-                    auto snapshot = on_full_snapshot();
-                    NetPacket packet { Net_Msg::FullSnapshot, snapshot };
-                    printf("sending scene snapshot %zu bytes", snapshot.size());
-                    send_packet(conn, packet, k_nSteamNetworkingSend_Reliable);
+                    Snapshot_Stream snapshot = on_full_snapshot(state);
+                    printf("streaming scene snapshot, %u entities %u bytes in %u chunks\n",
+                        snapshot.manifest.entity_count, snapshot.manifest.total_bytes, snapshot.manifest.chunk_count);
+
+                    release_stream(state);
+                    state.stream_tick = snapshot.manifest.tick;
+                    Net_Buffer* manifest = begin_frame(Net_Msg::SnapshotManifest, static_cast<uint32_t>(sizeof(Snapshot_Manifest) + snapshot.assets.size()));
+                    memcpy(manifest->data() + NET_HEADER_SIZE, &snapshot.manifest, sizeof(Snapshot_Manifest));
+                    if (!snapshot.assets.empty())
+                        memcpy(manifest->data() + NET_HEADER_SIZE + sizeof(Snapshot_Manifest), snapshot.assets.data(), snapshot.assets.size());
+
+                    // the chunks are already framed, their refs move to the stream
+                    state.stream.push_back(manifest);
+                    state.stream.insert(state.stream.end(), snapshot.chunks.begin(), snapshot.chunks.end());
+                }
+                else {
+                    state.fully_loaded = true;
                 }
 
-                state.fully_loaded = true;
                 if (on_client_joined) on_client_joined(conn, state.name);
                 break;
             }
 
             case Net_Msg::ClientInput: {
-                if (on_client_input)
-                    on_client_input(conn, pkt.payload.data(), pkt.payload.size());
+                Client_Input input;
+                auto it = m_clients.find(conn);
+                if (it == m_clients.end() || !pkt.to(input)) break;
+
+                // redundant, only the ones we have not seen yet are new
+                ClientState& state = it->second;
+                for (uint32_t i = 0; i < std::min(input.count, INPUT_REDUNDANCY); i++) {
+                    const Input_Command& cmd = input.commands[i];
+                    if (cmd.tick <= state.last_input_tick) continue;
+
+                    state.inputs.push_back(cmd);
+                    state.last_input_tick = cmd.tick;
+                }
+
+                while (state.inputs.size() > MAX_QUEUED_INPUTS)
+                    state.inputs.pop_front();
+                break;
+            }
+
+            case Net_Msg::SnapshotAck: {
+                Snapshot_Ack ack;
+                auto it = m_clients.find(conn);
+                if (it == m_clients.end() || !pkt.to(ack)) break;
+
+                // acks are unreliable and can arrive out of order
+                if (ack.tick > it->second.last_acked_tick)
+                    it->second.last_acked_tick = ack.tick;
+                break;
+            }
+
+            case Net_Msg::ClientViewpoint: {
+                Client_Viewpoint vp;
+                auto it = m_clients.find(conn);
+                if (it == m_clients.end() || !pkt.to(vp)) break;
+
+                memcpy(it->second.viewpoint, vp.position, sizeof(vp.position));
+                break;
+            }
+
+            case Net_Msg::StatsRequest: {
+                if (on_stats_request)
+                    send_struct(conn, Net_Msg::ServerStats, on_stats_request(), k_nSteamNetworkingSend_UnreliableNoNagle);
                 break;
             }
 
             case Net_Msg::ClientLeaving: {
                 Printf("Client %u sent graceful leave", conn);
                 remove_client(conn);
-                m_sockets->CloseConnection(conn, 0, "Client left", false);
+                m_transport->close(conn, "Client left", false);
                 break;
             }
 
@@ -175,11 +328,10 @@ private:
         switch (info->m_info.m_eState) {
             case k_ESteamNetworkingConnectionState_Connecting: {
                 Printf("Incoming connection from %s",info->m_info.m_szConnectionDescription);
-                if (m_sockets->AcceptConnection(info->m_hConn) != k_EResultOK) {
-                    m_sockets->CloseConnection(info->m_hConn, 0, "Accept failed", false);
+                if (!m_transport->accept(info->m_hConn)) {
+                    m_transport->close(info->m_hConn, "Accept failed", false);
                     break;
                 }
-                m_sockets->SetConnectionPollGroup(info->m_hConn, m_poll_group);
 
                 m_clients[info->m_hConn] = { info->m_hConn };
                 break;
@@ -190,7 +342,7 @@ private:
                 if (m_clients.count(info->m_hConn)) {
                     Printf("Connection %u lost: %s", info->m_hConn, info->m_info.m_szEndDebug);
                     remove_client(info->m_hConn);
-                    m_sockets->CloseConnection(info->m_hConn, 0, nullptr, false);
+                    m_transport->close(info->m_hConn, nullptr, false);
                 }
                 break;
             }
@@ -203,18 +355,72 @@ private:
     void remove_client(HSteamNetConnection conn) {
         if (on_client_left)
             on_client_left(conn);
+
+        auto it = m_clients.find(conn);
+        if (it != m_clients.end())
+            release_stream(it->second);
         m_clients.erase(conn);
     }
 
-    void send_packet(HSteamNetConnection conn, const NetPacket& pkt, int send_flags = k_nSteamNetworkingSend_Reliable) {
-        auto buf = pkt.serialize();
-        m_sockets->SendMessageToConnection(conn, buf.data(), static_cast<uint32_t>(buf.size()), send_flags, nullptr);
+    void release_stream(ClientState& state) {
+        for (size_t i = state.stream_next; i < state.stream.size(); i++)
+            Net_Buffer_Pool::release(state.stream[i]);
+        state.stream.clear();
+        state.stream_next = 0;
     }
 
-    static void connection_status_changed_static(
-        SteamNetConnectionStatusChangedCallback_t* info) {
-        s_instance->on_connection_status_changed(info);
+    // sends the next chunks of every streaming client within this tick's
+    // budget, skipping connections that still have plenty queued in the transport.
+    // a client is loaded and starts receiving deltas after its last chunk,
+    // the first against the snapshot the stream was written from. it may
+    // arrive before the reliable chunks, the client drops it and the next
+    // one is against the same baseline
+    void pump_streams() {
+        uint32_t budget = stream_bytes_per_tick;
+
+        for (auto& [conn, state] : m_clients) {
+            if (state.stream.empty()) continue;
+
+            int32_t pending = m_transport->pending_reliable(conn);
+            while (state.stream_next < state.stream.size() && budget > 0 && pending < static_cast<int32_t>(stream_max_pending)) {
+                Net_Buffer* buf = state.stream[state.stream_next++];
+                budget -= std::min(budget, buf->size);
+                pending += static_cast<int32_t>(buf->size);
+
+                m_outgoing.push_back(m_transport->make_message(buf, conn, k_nSteamNetworkingSend_Reliable));
+                Net_Buffer_Pool::release(buf);
+            }
+
+            if (state.stream_next == state.stream.size()) {
+                state.stream.clear();
+                state.stream_next = 0;
+                state.fully_loaded = true;
+                state.last_acked_tick = std::max(state.last_acked_tick, state.stream_tick);
+            }
+        }
+
+        flush_outgoing();
     }
-};
 
-inline Server* Server::s_instance = nullptr;
+    // the transport takes ownership of the message, buf keeps the caller's ref
+    void send_buffer(HSteamNetConnection conn, Net_Buffer* buf, int send_flags) {
+        SteamNetworkingMessage_t* msg = m_transport->make_message(buf, conn, send_flags);
+        if (m_net.running())
+            m_net.send(msg);
+        else
+            m_transport->send(&msg, 1);
+    }
+
+    void flush_outgoing() {
+        if (m_outgoing.empty()) return;
+
+        if (m_net.running()) {
+            for (SteamNetworkingMessage_t* msg : m_outgoing)
+                m_net.send(msg);
+        }
+        else {
+            m_transport->send(m_outgoing.data(), static_cast<int>(m_outgoing.size()));
+        }
+        m_outgoing.clear();
+    }
+};
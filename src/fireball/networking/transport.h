@@ -0,0 +1,171 @@
+#pragma once
+
+#include "networking.h"
+#include "net_buffer.h"
+
+#include <steam/steamnetworkingsockets.h>
+#include <steam/isteamnetworkingutils.h>
+
+#include <functional>
+#include <mutex>
+
+// what Server and Client send and receive through. messages and connection
+// status changes keep the gns types so both transports look the same to
+// their users, a transport only decides how they travel
+
+class Net_Transport {
+public:
+    // invoked from run_callbacks(), on whichever thread calls it
+    std::function<void(SteamNetConnectionStatusChangedCallback_t*)> on_status;
+
+    virtual ~Net_Transport() = default;
+
+    virtual bool listen(uint16_t port) = 0;
+    // k_HSteamNetConnection_Invalid on failure
+    virtual HSteamNetConnection connect(const char* ip, uint16_t port) = 0;
+    virtual bool accept(HSteamNetConnection conn) = 0;
+    virtual void close(HSteamNetConnection conn, const char* reason, bool linger) = 0;
+
+    // from every connection of this transport, the caller releases them
+    virtual int receive(SteamNetworkingMessage_t** out, int max) = 0;
+    // takes ownership of the messages
+    virtual void send(SteamNetworkingMessage_t* const* msgs, int count) = 0;
+    virtual void run_callbacks() = 0;
+
+    // reliable bytes still queued for conn
+    virtual int pending_reliable(HSteamNetConnection conn) = 0;
+    // round trip, -1 if unknown
+    virtual int ping_ms(HSteamNetConnection conn) = 0;
+
+    // stops listening, connections have to be closed before
+    virtual void shutdown() = 0;
+
+    // an empty message for send(), released by whoever ends up owning it
+    virtual SteamNetworkingMessage_t* allocate_message() = 0;
+
+    // the message takes its own ref on buf
+    SteamNetworkingMessage_t* make_message(Net_Buffer* buf, HSteamNetConnection conn, int send_flags) {
+        return ::make_message(allocate_message(), buf, conn, send_flags);
+    }
+};
+
+// real udp through GameNetworkingSockets. the library is initialized by the
+// first transport and shut down with the last one
+class Gns_Transport : public Net_Transport {
+public:
+    Gns_Transport() {
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+            if (s_count++ == 0)
+                InitSteamDatagramConnectionSockets();
+        }
+
+        m_sockets = SteamNetworkingSockets();
+        m_poll_group = m_sockets->CreatePollGroup();
+    }
+
+    ~Gns_Transport() override {
+        if (m_poll_group != k_HSteamNetPollGroup_Invalid)
+            m_sockets->DestroyPollGroup(m_poll_group);
+
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if (--s_count == 0)
+            ShutdownSteamDatagramConnectionSockets();
+    }
+
+    bool listen(uint16_t port) override {
+        SteamNetworkingIPAddr addr;
+        addr.Clear();
+        addr.m_port = port;
+
+        SteamNetworkingConfigValue_t opts[2];
+        config(opts);
+
+        m_listen_socket = m_sockets->CreateListenSocketIP(addr, 2, opts);
+        return m_listen_socket != k_HSteamListenSocket_Invalid;
+    }
+
+    HSteamNetConnection connect(const char* ip, uint16_t port) override {
+        SteamNetworkingIPAddr addr;
+        addr.Clear();
+        addr.ParseString(ip);
+        addr.m_port = port;
+
+        SteamNetworkingConfigValue_t opts[2];
+        config(opts);
+
+        HSteamNetConnection conn = m_sockets->ConnectByIPAddress(addr, 2, opts);
+        if (conn != k_HSteamNetConnection_Invalid)
+            m_sockets->SetConnectionPollGroup(conn, m_poll_group);
+        return conn;
+    }
+
+    bool accept(HSteamNetConnection conn) override {
+        if (m_sockets->AcceptConnection(conn) != k_EResultOK)
+            return false;
+        m_sockets->SetConnectionPollGroup(conn, m_poll_group);
+        return true;
+    }
+
+    void close(HSteamNetConnection conn, const char* reason, bool linger) override {
+        m_sockets->CloseConnection(conn, 0, reason, linger);
+    }
+
+    int receive(SteamNetworkingMessage_t** out, int max) override {
+        return m_sockets->ReceiveMessagesOnPollGroup(m_poll_group, out, max);
+    }
+
+    void send(SteamNetworkingMessage_t* const* msgs, int count) override {
+        m_sockets->SendMessages(count, msgs, nullptr);
+    }
+
+    void run_callbacks() override {
+        m_sockets->RunCallbacks();
+    }
+
+    int pending_reliable(HSteamNetConnection conn) override {
+        SteamNetConnectionRealTimeStatus_t status;
+        if (m_sockets->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) != k_EResultOK)
+            return 0;
+        return status.m_cbPendingReliable;
+    }
+
+    int ping_ms(HSteamNetConnection conn) override {
+        SteamNetConnectionRealTimeStatus_t status;
+        if (m_sockets->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) != k_EResultOK)
+            return -1;
+        return status.m_nPing;
+    }
+
+    void shutdown() override {
+        if (m_listen_socket != k_HSteamListenSocket_Invalid) {
+            m_sockets->CloseListenSocket(m_listen_socket);
+            m_listen_socket = k_HSteamListenSocket_Invalid;
+        }
+    }
+
+    SteamNetworkingMessage_t* allocate_message() override {
+        return SteamNetworkingUtils()->AllocateMessage(0);
+    }
+
+private:
+    ISteamNetworkingSockets* m_sockets = nullptr;
+    HSteamListenSocket m_listen_socket = k_HSteamListenSocket_Invalid;
+    HSteamNetPollGroup m_poll_group = k_HSteamNetPollGroup_Invalid;
+
+    static inline std::mutex s_mutex;
+    static inline uint32_t s_count = 0; // transports alive
+
+    // status callbacks find their transport through the connection user
+    // data, accepted connections inherit it from the listen socket
+    void config(SteamNetworkingConfigValue_t* opts) {
+        opts[0].SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged, (void*)status_changed_static);
+        opts[1].SetInt64(k_ESteamNetworkingConfig_ConnectionUserData, reinterpret_cast<intptr_t>(this));
+    }
+
+    static void status_changed_static(SteamNetConnectionStatusChangedCallback_t* info) {
+        auto* self = reinterpret_cast<Gns_Transport*>(info->m_info.m_nUserData);
+        if (info->m_info.m_nUserData != -1 && self->on_status)
+            self->on_status(info);
+    }
+};
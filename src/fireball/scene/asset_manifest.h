@@ -0,0 +1,224 @@
+#pragma once
+
+#include "serializer.h"
+#include "fireball/core/jobs.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include <flecs.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// asset manifest, sent after the Snapshot_Manifest in the same message
+// every model the snapshot references once, with the textures its materials
+// use, nearest to the client first. the client starts loading all of it
+// before the first chunk is applied instead of discovering models one
+// entity at a time and their textures only once a model is parsed
+//   [uint16 asset_count]
+//   per asset: [string model][uint32 size_bytes][uint16 references]
+//              [uint8 texture_count][string texture] * texture_count
+// paths are relative to the model base path
+
+struct Asset_Manifest_Entry {
+    std::string model;
+    uint32_t size_bytes;  // model and its textures on disk, an estimate for progress
+    uint16_t references;  // entities using it
+    std::vector<std::string> textures;
+};
+
+// what the server knows about a model file, read from disk once per path.
+// reading a model takes a full Assimp parse, so it runs as a Low job as soon
+// as the model is first used, never on the tick thread
+class Asset_Catalog {
+public:
+    struct Model_Info {
+        uint32_t size_bytes = 0;
+        std::vector<std::string> textures;
+    };
+
+    // scans still running hold on to the catalog
+    ~Asset_Catalog() {
+        Jobs::wait(m_scans);
+    }
+
+    // starts the scan of a model not seen yet
+    void request(const std::string& path) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_models.try_emplace(path).second) return;
+        }
+
+        Jobs::submit([this, path]() {
+            Model_Info info;
+            scan(path, info);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            Model_State& state = m_models[path];
+            state.info = std::move(info);
+            state.scanned = true;
+        }, Job_Priority::Low, &m_scans);
+    }
+
+    // false while the scan is still running, the model is requested if it was not
+    bool find(const std::string& path, Model_Info& out) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_models.find(path);
+            if (it != m_models.end()) {
+                if (!it->second.scanned) return false;
+                out = it->second.info;
+                return true;
+            }
+        }
+        request(path);
+        return false;
+    }
+
+private:
+    struct Model_State {
+        Model_Info info;
+        bool scanned = false;
+    };
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, Model_State> m_models;
+    Job_Counter m_scans;
+
+    static uint32_t file_size(const std::string& path) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(path, ec);
+        return ec ? 0 : static_cast<uint32_t>(std::min<uintmax_t>(size, UINT32_MAX));
+    }
+
+    // the same texture slots Model_Manager::load_material loads, embedded
+    // textures come with the model
+    static void scan(const std::string& path, Model_Info& info) {
+        const std::string full_path = Model_Manager::get_base_path() + path;
+        const std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        info.size_bytes = file_size(full_path);
+
+        Assimp::Importer import;
+        const aiScene* scene = import.ReadFile(full_path, 0);
+        if (!scene) {
+            printf("[ASSETS] Could not read %s, sent without textures\n", full_path.c_str());
+            return;
+        }
+
+        for (uint32_t i = 0; i < scene->mNumMaterials; i++) {
+            for (aiTextureType type : { aiTextureType_BASE_COLOR, aiTextureType_NORMALS }) {
+                aiString str;
+                if (!scene->mMaterials[i]->GetTextureCount(type)) continue;
+                if (scene->mMaterials[i]->GetTexture(type, 0, &str) != AI_SUCCESS) continue;
+                if (str.C_Str()[0] == '*') continue;
+
+                std::string texture = directory + str.C_Str();
+                if (std::find(info.textures.begin(), info.textures.end(), texture) != info.textures.end()) continue;
+
+                info.size_bytes += file_size(Model_Manager::get_base_path() + texture);
+                info.textures.push_back(std::move(texture));
+            }
+        }
+    }
+};
+
+// filter: sorted entity ids in the snapshot, null for all of them
+static std::vector<uint8_t> serialize_asset_manifest(flecs::world& world, const std::vector<uint64_t>* filter, vec3 viewpoint, Asset_Catalog& catalog) {
+    struct Wanted {
+        const std::string* model;
+        uint32_t references = 0;
+        float distance2 = FLT_MAX;
+    };
+
+    std::unordered_map<std::string, Wanted> wanted;
+    world.each([&](flecs::entity e, const Server_Model_Component& m) {
+        if (filter && !std::binary_search(filter->begin(), filter->end(), e.id())) return;
+
+        auto [it, inserted] = wanted.try_emplace(m.model_name);
+        Wanted& w = it->second;
+        w.model = &it->first;
+        w.references++;
+
+        if (const Transform_Component* t = e.try_get<Transform_Component>()) {
+            vec3 d = vec3(t->world_transform[3]) - viewpoint;
+            w.distance2 = std::min(w.distance2, dot(d, d));
+        }
+    });
+
+    std::vector<Wanted> order;
+    order.reserve(wanted.size());
+    for (auto& [model, w] : wanted)
+        order.push_back(w);
+
+    std::sort(order.begin(), order.end(), [](const Wanted& a, const Wanted& b) {
+        if (a.distance2 != b.distance2) return a.distance2 < b.distance2;
+        return a.references > b.references;
+    });
+
+    // models still being scanned go without size and textures, the client
+    // finds their textures once the model is parsed
+    ByteWriter w;
+    Asset_Catalog::Model_Info info;
+    w.write(static_cast<uint16_t>(std::min<size_t>(order.size(), UINT16_MAX)));
+    for (size_t i = 0; i < order.size() && i < UINT16_MAX; i++) {
+        if (!catalog.find(*order[i].model, info))
+            info = {};
+
+        w.write_string(*order[i].model);
+        w.write(info.size_bytes);
+        w.write(static_cast<uint16_t>(std::min<uint32_t>(order[i].references, UINT16_MAX)));
+
+        uint8_t texture_count = static_cast<uint8_t>(std::min<size_t>(info.textures.size(), UINT8_MAX));
+        w.write(texture_count);
+        for (uint8_t t = 0; t < texture_count; t++)
+            w.write_string(info.textures[t]);
+    }
+
+    return std::move(w.data);
+}
+
+static bool deserialize_asset_manifest(ByteReader& r, std::vector<Asset_Manifest_Entry>& out) {
+    out.clear();
+
+    uint16_t count;
+    if (!r.read(count)) return false;
+
+    out.resize(count);
+    for (Asset_Manifest_Entry& entry : out) {
+        if (!r.read_string(entry.model)) return false;
+        if (!r.read(entry.size_bytes))   return false;
+        if (!r.read(entry.references))   return false;
+
+        uint8_t texture_count;
+        if (!r.read(texture_count)) return false;
+
+        entry.textures.resize(texture_count);
+        for (std::string& texture : entry.textures) {
+            if (!r.read_string(texture)) return false;
+        }
+    }
+
+    return true;
+}
+
+#ifdef FIREBALL_CLIENT
+#include "asset/texture_manager.h"
+
+// starts every load in manifest order, the loaders run in the background.
+// entities that arrive later find their model already loading or loaded
+static void prefetch_assets(const std::vector<Asset_Manifest_Entry>& assets) {
+    const std::string& base = Model_Manager::get_base_path();
+
+    for (const Asset_Manifest_Entry& entry : assets) {
+        Model_Manager::load_model(entry.model);
+        for (const std::string& texture : entry.textures)
+            Texture_Manager::load(base + texture);
+    }
+}
+#endif
@@ -4,7 +4,10 @@
 #include "fireball/core/physics.h"
 #include "fireball/util/math.h"
 
+#include <array>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 struct Transform_Component {
 	vec3 position = vec3(0.0f);
@@ -22,8 +25,36 @@ struct Name_Component {
 };
 
 struct Physics_Component {
-	Physics_Handle handle;
+	Physics_Handle handle; // invalid: the scene creates the body, batched, on its next update
 	Physics_Info info;
+	bool is_static = false;
+
+	// body transform after the last two physics steps, shown blended by Physics::alpha()
+	vec3 previous_position = vec3(0.0f);
+	vec3 current_position = vec3(0.0f);
+	quat previous_orientation = quat(0.0f, 0.0f, 0.0f, 1.0f);
+	quat current_orientation = quat(0.0f, 0.0f, 0.0f, 1.0f);
+	uint64_t synced_step = UINT64_MAX; // Physics::step_count() they were read at
+};
+
+// on entities whose body is asleep, added and removed as the scene drains
+// activation events
+struct Physics_Sleeping {};
+
+struct Physics_Contact {
+	uint64_t entity1; // 0 for bodies without an entity
+	uint64_t entity2;
+	vec3 point;
+	vec3 normal; // from entity1 to entity2
+	float impulse;
+};
+
+// singleton, the contacts of the physics steps since the scene's last
+// update, replaced every update. for systems that handle collisions in bulk
+struct Physics_Contacts {
+	std::vector<Physics_Contact> added;
+	std::vector<Physics_Contact> persisted; // only with Physics::set_event_mask
+	std::vector<Physics_Contact> removed;   // point, normal and impulse are 0
 };
 
 struct Model_Component {
@@ -53,6 +84,50 @@ struct Light_Component {
 	bool enabled = true;
 };
 
+// client side history of a remote entity's transform, stamped with server
+// time. the entity is rendered a bit in the past between two samples
+// instead of snapping to every snapshot as it arrives
+struct Interpolation_Component {
+	struct Sample {
+		double time;
+		vec3 position;
+		quat rotation;
+		vec3 scale;
+	};
+
+	static constexpr uint32_t CAPACITY = 32;
+
+	std::array<Sample, CAPACITY> samples;
+	uint32_t head = 0; // next write
+	uint32_t count = 0;
+
+	// samples arrive in order, anything not newer than the last one is dropped
+	void push(const Sample& s) {
+		if (count && s.time <= newest().time)
+			return;
+		samples[head] = s;
+		head = (head + 1) % CAPACITY;
+		count = count < CAPACITY ? count + 1 : CAPACITY;
+	}
+
+	// 0 is the oldest
+	const Sample& at(uint32_t i) const { return samples[(head + CAPACITY - count + i) % CAPACITY]; }
+	const Sample& newest() const { return at(count - 1); }
+};
+
+// the time remote entities are rendered at, set by the client every frame
+struct Interpolation_Time {
+	double render_time = 0.0;
+	double max_extrapolation = 0.1;
+};
+
+// the local player, simulated by the client ahead of the server. snapshots
+// do not write its transform, server state comes in through Input_Ack
+struct Predicted_Component {};
+
+// replicated to every client regardless of distance
+struct Always_Relevant {};
+
 struct Lifetime_Component {
 
 };
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include "fireball/util/math.h"
+
+#include <steam/steamnetworkingtypes.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// server side interest management, every client is only sent the entities
+// near its viewpoint. the grid is rebuilt from each captured snapshot so it
+// never touches the ecs, views are kept per tick so deltas can be encoded
+// against what the client actually saw at its acked baseline
+
+struct Interest_Settings {
+    float cell_size = 64.0f;
+    float relevance_radius = 150.0f;
+};
+
+using Relevant_Set = std::vector<uint64_t>; // sorted entity ids
+
+class Interest_Grid {
+public:
+    // indices into snapshot.entities
+    void build(const Net_Snapshot& snapshot, float cell_size) {
+        m_cell_size = cell_size;
+        m_cells.clear();
+        m_always.clear();
+
+        for (uint32_t i = 0; i < snapshot.entities.size(); i++) {
+            const Net_Entity_State& s = snapshot.entities[i];
+            if (s.always_relevant)
+                m_always.push_back(i);
+            else
+                m_cells.push_back({ key(cell_of(s.world_position.x), cell_of(s.world_position.y), cell_of(s.world_position.z)), i });
+        }
+
+        std::sort(m_cells.begin(), m_cells.end());
+    }
+
+    template<typename F>
+    void query(const vec3& center, float radius, F&& f) const {
+        for (uint32_t i : m_always)
+            f(i);
+
+        int32_t x0 = cell_of(center.x - radius), x1 = cell_of(center.x + radius);
+        int32_t y0 = cell_of(center.y - radius), y1 = cell_of(center.y + radius);
+        int32_t z0 = cell_of(center.z - radius), z1 = cell_of(center.z + radius);
+
+        for (int32_t x = x0; x <= x1; x++)
+        for (int32_t y = y0; y <= y1; y++)
+        for (int32_t z = z0; z <= z1; z++) {
+            auto [begin, end] = std::equal_range(m_cells.begin(), m_cells.end(), std::pair<uint64_t, uint32_t>(key(x, y, z), 0),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+            for (auto it = begin; it != end; it++)
+                f(it->second);
+        }
+    }
+
+private:
+    float m_cell_size = 64.0f;
+    std::vector<std::pair<uint64_t, uint32_t>> m_cells; // (cell key, entity index), sorted
+    std::vector<uint32_t> m_always;
+
+    int32_t cell_of(float v) const {
+        return static_cast<int32_t>(std::floor(v / m_cell_size));
+    }
+
+    // 21 bits per axis
+    static uint64_t key(int32_t x, int32_t y, int32_t z) {
+        constexpr uint64_t mask = (1ull << 21) - 1;
+        return ((uint64_t(x) & mask) << 42) | ((uint64_t(y) & mask) << 21) | (uint64_t(z) & mask);
+    }
+};
+
+class Interest_Manager {
+public:
+    Interest_Settings settings;
+
+    void build(const Net_Snapshot& snapshot) {
+        m_snapshot = &snapshot;
+        m_grid.build(snapshot, settings.cell_size);
+    }
+
+    bool built() const { return m_snapshot != nullptr; }
+
+    // everything within the relevance radius of viewpoint, plus the parents
+    // of those so the hierarchy resolves on the client
+    void compute_view(const vec3& viewpoint, Relevant_Set& out) const {
+        out.clear();
+        if (!m_snapshot) return;
+
+        const float radius_sq = settings.relevance_radius * settings.relevance_radius;
+        m_grid.query(viewpoint, settings.relevance_radius, [&](uint32_t i) {
+            const Net_Entity_State& s = m_snapshot->entities[i];
+            vec3 d = s.world_position - viewpoint;
+            if (s.always_relevant || glm::dot(d, d) <= radius_sq)
+                out.push_back(s.entity_id);
+        });
+
+        for (size_t i = 0; i < out.size(); i++) {
+            const Net_Entity_State* s = find_entity(*m_snapshot, out[i]);
+            if (s && s->parent_id && find_entity(*m_snapshot, s->parent_id))
+                out.push_back(s->parent_id);
+        }
+
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    // stores the client's view for tick and fills left with the ids that
+    // were visible at its previous update but no longer are. snapshot ticks
+    // are not consecutive when the server caught up steps
+    const Relevant_Set& update_client(HSteamNetConnection conn, uint32_t tick, const vec3& viewpoint, std::vector<uint64_t>& left) {
+        Client_Views& views = m_clients[conn];
+
+        const View_Slot& prev = views.slots[views.last_tick % SNAPSHOT_RING_SIZE];
+        View_Slot& slot = views.slots[tick % SNAPSHOT_RING_SIZE];
+
+        left.clear();
+        if (views.last_tick && prev.tick == views.last_tick) {
+            compute_view(viewpoint, m_scratch);
+            std::set_difference(prev.view.begin(), prev.view.end(), m_scratch.begin(), m_scratch.end(), std::back_inserter(left));
+            slot.view.swap(m_scratch);
+        }
+        else {
+            compute_view(viewpoint, slot.view);
+        }
+
+        slot.tick = tick;
+        views.last_tick = tick;
+        return slot.view;
+    }
+
+    // what conn could see at tick, nullptr if that is no longer known
+    const Relevant_Set* view(HSteamNetConnection conn, uint32_t tick) const {
+        auto it = m_clients.find(conn);
+        if (it == m_clients.end() || tick == 0) return nullptr;
+
+        const View_Slot& slot = it->second.slots[tick % SNAPSHOT_RING_SIZE];
+        return slot.tick == tick ? &slot.view : nullptr;
+    }
+
+    void remove_client(HSteamNetConnection conn) {
+        m_clients.erase(conn);
+    }
+
+private:
+    struct View_Slot {
+        uint32_t tick = 0;
+        Relevant_Set view;
+    };
+    struct Client_Views {
+        std::array<View_Slot, SNAPSHOT_RING_SIZE> slots;
+        uint32_t last_tick = 0;
+    };
+
+    Interest_Grid m_grid;
+    Relevant_Set m_scratch;
+    const Net_Snapshot* m_snapshot = nullptr;
+    std::unordered_map<HSteamNetConnection, Client_Views> m_clients;
+};
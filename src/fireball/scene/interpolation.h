@@ -0,0 +1,111 @@
+#pragma once
+
+#include "components.h"
+#include "serializer.h"
+
+#include "fireball/util/math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// snapshot interpolation
+// remote entities are shown at render_time = server_time - delay. the
+// client estimates the server clock from snapshot ticks, and the delay is
+// adapted to cover the send interval plus the measured arrival jitter so
+// there is almost always a newer sample to interpolate towards. when there
+// is not (packet loss), the last motion is extrapolated for a short while
+
+struct Interpolation_Clock {
+    double tick_interval = 1.0 / 128.0; // from Client_Accepted
+
+    double min_delay = 0.02;
+    double max_delay = 0.25;
+    double max_extrapolation = 0.1;
+
+    double offset = 0.0;        // local time - server time, lower bound as packets that arrive fastest define it
+    double jitter = 0.0;        // smoothed deviation of arrivals from offset
+    double send_interval = 0.0; // smoothed server time between snapshots
+    double delay = 0.1;
+    uint32_t last_tick = 0;
+
+    double server_time(uint32_t tick) const {
+        return tick * tick_interval;
+    }
+
+    void on_snapshot(uint32_t tick, double local_time) {
+        double sample = local_time - server_time(tick);
+
+        if (last_tick == 0) {
+            offset = sample;
+            send_interval = tick_interval;
+        }
+        else {
+            // latency only drops suddenly, let it creep up slowly so clock drift is tracked
+            if (sample < offset)
+                offset = sample;
+            else
+                offset += (sample - offset) * 0.002;
+
+            jitter += (std::abs(sample - offset) - jitter) * 0.1;
+            if (tick > last_tick)
+                send_interval += (server_time(tick) - server_time(last_tick) - send_interval) * 0.1;
+        }
+        last_tick = std::max(last_tick, tick);
+
+        // one send interval to always have a next sample, jitter on top to absorb late ones.
+        // adapted slowly since every change of delay shifts everything rendered
+        double target = std::clamp(send_interval * 1.5 + jitter * 2.5, min_delay, max_delay);
+        delay += (target - delay) * 0.05;
+    }
+
+    double render_time(double local_time) const {
+        return local_time - offset - delay;
+    }
+};
+
+// false if there is nothing to show
+static bool sample_interpolation(const Interpolation_Component& ic, double time, double max_extrapolation, Interpolation_Component::Sample& out) {
+    if (ic.count == 0) return false;
+
+    const auto& oldest = ic.at(0);
+    const auto& newest = ic.newest();
+
+    if (ic.count == 1 || time <= oldest.time) {
+        out = time <= oldest.time ? oldest : newest;
+        return true;
+    }
+
+    if (time >= newest.time) {
+        // past the newest sample, keep moving along the last velocity for a bit
+        const auto& prev = ic.at(ic.count - 2);
+        double span = newest.time - prev.time;
+        double ahead = std::min(time - newest.time, max_extrapolation);
+        float t = span > 0.0 ? static_cast<float>(ahead / span) : 0.0f;
+
+        out.time = newest.time + ahead;
+        out.position = newest.position + (newest.position - prev.position) * t;
+        out.rotation = newest.rotation;
+        out.scale = newest.scale;
+        return true;
+    }
+
+    // newest first, render time is usually close to it
+    uint32_t i = ic.count - 1;
+    while (i > 0 && ic.at(i - 1).time > time)
+        i--;
+
+    const auto& a = ic.at(i - 1);
+    const auto& b = ic.at(i);
+    float t = static_cast<float>((time - a.time) / (b.time - a.time));
+
+    out.time = time;
+    out.position = glm::mix(a.position, b.position, t);
+    out.rotation = glm::slerp(a.rotation, b.rotation, t);
+    out.scale = glm::mix(a.scale, b.scale, t);
+    return true;
+}
+
+static Interpolation_Component::Sample make_interpolation_sample(double time, const Transform_Component& t) {
+    return { time, t.position, euler_to_quat(t.rotation), t.scale };
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "fireball/networking/network_protocol.h"
+#include "fireball/util/math.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+// player movement shared by server and client
+// the client predicts its own player by running the exact same step on its
+// inputs, the server runs them again when they arrive and acks the result.
+// anything that affects the outcome has to go through Input_Command
+
+struct Movement_Settings {
+    float speed = 8.0f;
+    float jump_velocity = 6.0f;
+    float gravity = 20.0f;
+    float ground_height = 0.0f;
+};
+
+struct Movement_State {
+    vec3 position = vec3(0.0f);
+    vec3 velocity = vec3(0.0f);
+    float yaw = 0.0f; // of the newest input, radians
+};
+
+// euler rotation of the player's transform, facing +x at yaw 0 like the camera
+static vec3 movement_rotation(const Movement_State& m) {
+    return vec3(0.0f, -m.yaw, 0.0f);
+}
+
+static void simulate_movement(Movement_State& m, const Input_Command& input, float dt, const Movement_Settings& settings = {}) {
+    vec3 wish(input.move_x / 127.0f, 0.0f, input.move_z / 127.0f);
+    if (glm::dot(wish, wish) > 1.0f)
+        wish = glm::normalize(wish);
+
+    // same convention as Camera, yaw 0 looks down +x
+    float s = std::sin(input.yaw), c = std::cos(input.yaw);
+    vec3 forward(c, 0.0f, s);
+    vec3 right(-s, 0.0f, c);
+    vec3 horizontal = (forward * wish.z + right * wish.x) * settings.speed;
+
+    m.velocity.x = horizontal.x;
+    m.velocity.z = horizontal.z;
+    m.yaw = input.yaw;
+
+    bool grounded = m.position.y <= settings.ground_height;
+    if (grounded && (input.buttons & Input_Jump))
+        m.velocity.y = settings.jump_velocity;
+    else if (!grounded)
+        m.velocity.y -= settings.gravity * dt;
+
+    m.position += m.velocity * dt;
+
+    if (m.position.y < settings.ground_height) {
+        m.position.y = settings.ground_height;
+        m.velocity.y = 0.0f;
+    }
+}
+
+static Movement_State movement_from_ack(const Input_Ack& ack) {
+    return {
+        vec3(ack.position[0], ack.position[1], ack.position[2]),
+        vec3(ack.velocity[0], ack.velocity[1], ack.velocity[2]),
+    };
+}
+
+// client side, inputs not yet acked by the server. on every ack the state is
+// reset to the server's and the remaining inputs are replayed on top
+class Input_Predictor {
+public:
+    static constexpr uint32_t CAPACITY = 256; // 2s at 128hz
+
+    Movement_State state;
+    Movement_Settings settings;
+
+    // runs one step locally, the command is stamped with the next input tick
+    const Input_Command& record(Input_Command input, float dt) {
+        input.tick = m_next_tick++;
+        m_inputs[input.tick % CAPACITY] = input;
+
+        // too far ahead of the server, the oldest input is lost for prediction
+        if (input.tick - m_acked >= CAPACITY)
+            m_acked = input.tick - CAPACITY + 1;
+
+        simulate_movement(state, input, dt, settings);
+        return m_inputs[input.tick % CAPACITY];
+    }
+
+    // the last INPUT_REDUNDANCY unacked inputs, oldest first
+    void fill_packet(Client_Input& out) const {
+        uint32_t pending = m_next_tick - 1 - m_acked;
+        out.count = std::min(pending, INPUT_REDUNDANCY);
+
+        uint32_t first = m_next_tick - out.count;
+        for (uint32_t i = 0; i < out.count; i++)
+            out.commands[i] = m_inputs[(first + i) % CAPACITY];
+    }
+
+    bool has_pending() const { return m_next_tick - 1 > m_acked; }
+
+    // returns how far the prediction was off
+    float reconcile(const Input_Ack& ack, float dt) {
+        if (ack.input_tick <= m_acked || ack.input_tick >= m_next_tick)
+            return 0.0f;
+
+        m_acked = ack.input_tick;
+
+        // the ack has no yaw, the newest input's is kept when none are replayed
+        vec3 predicted = state.position;
+        float yaw = state.yaw;
+        state = movement_from_ack(ack);
+        state.yaw = yaw;
+        for (uint32_t tick = m_acked + 1; tick < m_next_tick; tick++)
+            simulate_movement(state, m_inputs[tick % CAPACITY], dt, settings);
+
+        return glm::length(state.position - predicted);
+    }
+
+    void reset(const Movement_State& s) {
+        state = s;
+        m_acked = m_next_tick - 1;
+    }
+
+private:
+    std::array<Input_Command, CAPACITY> m_inputs {};
+    uint32_t m_next_tick = 1;
+    uint32_t m_acked = 0; // newest input tick the server has run
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <flecs.h>
+
+#include <cstdint>
+#include <vector>
+
+// server entity id -> local proxy
+// a flat array indexed by the server's entity index, the low 32 bits of its
+// flecs id, so a lookup is one load instead of a hash. the full id is kept
+// per slot, a recycled index with a new generation does not match the old
+// proxy
+class Net_Id_Map {
+public:
+    // a null entity if server_id has no proxy
+    flecs::entity find(uint64_t server_id) const {
+        uint32_t index = static_cast<uint32_t>(server_id);
+        if (index >= m_slots.size() || m_slots[index].server_id != server_id)
+            return flecs::entity();
+        return m_slots[index].local;
+    }
+
+    bool contains(uint64_t server_id) const {
+        return find(server_id).id() != 0;
+    }
+
+    void insert(uint64_t server_id, flecs::entity local) {
+        uint32_t index = static_cast<uint32_t>(server_id);
+        if (index >= m_slots.size())
+            m_slots.resize(index + 1);
+
+        Slot& slot = m_slots[index];
+        if (slot.server_id == 0)
+            m_count++;
+        slot.server_id = server_id;
+        slot.local = local;
+    }
+
+    void erase(uint64_t server_id) {
+        uint32_t index = static_cast<uint32_t>(server_id);
+        if (index >= m_slots.size() || m_slots[index].server_id != server_id) return;
+
+        m_slots[index] = {};
+        m_count--;
+    }
+
+    size_t size() const { return m_count; }
+
+    // f(uint64_t server_id, flecs::entity local), in server index order
+    template<typename F>
+    void for_each(F&& f) const {
+        for (const Slot& slot : m_slots) {
+            if (slot.server_id != 0)
+                f(slot.server_id, slot.local);
+        }
+    }
+
+private:
+    struct Slot {
+        uint64_t server_id = 0;
+        flecs::entity local;
+    };
+
+    std::vector<Slot> m_slots;
+    size_t m_count = 0;
+};
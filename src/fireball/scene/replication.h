@@ -0,0 +1,331 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <flecs.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// change tracked replication
+// observers on the replicated components log which (entity, component)
+// pairs were set, modified or removed each tick, and which entities were
+// created, reparented or destroyed. a snapshot slot is then brought up to
+// date from what it held SNAPSHOT_RING_SIZE ticks ago by re-reading only the
+// entities in that window's logs, and every component is stamped with the
+// tick it last changed at so deltas skip the untouched ones.
+// writes through get_mut are invisible to flecs, they must be followed by
+// e.modified<T>() or they are never sent. debug builds check for that by
+// comparing a capture with a full rescan every verify_interval ticks
+
+struct Net_Change {
+    uint64_t entity_id;
+    NetComponentID component;
+};
+
+struct Tick_Changes {
+    uint32_t tick = 0;
+    std::vector<Net_Change> components;
+    std::vector<uint64_t> entities; // created, reparented, retagged or destroyed, re-read whole
+};
+
+class Replication_Log {
+public:
+#ifndef NDEBUG
+    uint32_t verify_interval = 128; // 0 turns the check off
+#endif
+
+    explicit Replication_Log(flecs::world& world) {
+        Net_Registry::for_each([&]<typename T>(NetComponentID id) {
+            observe<T>(world, id);
+        });
+
+        m_observers.push_back(world.observer()
+            .with<Name_Component>()
+            .event(flecs::OnAdd)
+            .event(flecs::OnRemove)
+            .each([this](flecs::entity e) {
+                m_current->entities.push_back(e.id());
+            }));
+
+        m_observers.push_back(world.observer()
+            .with(flecs::ChildOf, flecs::Wildcard)
+            .event(flecs::OnAdd)
+            .event(flecs::OnRemove)
+            .each([this](flecs::entity e) {
+                m_current->entities.push_back(e.id());
+            }));
+
+        m_observers.push_back(world.observer()
+            .with<Always_Relevant>()
+            .event(flecs::OnAdd)
+            .event(flecs::OnRemove)
+            .each([this](flecs::entity e) {
+                m_current->entities.push_back(e.id());
+            }));
+    }
+
+    // the world has to outlive the log
+    ~Replication_Log() {
+        for (flecs::entity& o : m_observers)
+            o.destruct();
+    }
+
+    Replication_Log(const Replication_Log&) = delete;
+    Replication_Log& operator=(const Replication_Log&) = delete;
+
+    // changes from here on belong to tick, call once per snapshot tick before
+    // anything is simulated for it
+    void begin_tick(uint32_t tick) {
+        m_current = &m_ring[tick % SNAPSHOT_RING_SIZE];
+        m_current->tick = tick;
+        m_current->components.clear();
+        m_current->entities.clear();
+    }
+
+    const Tick_Changes* find(uint32_t tick) const {
+        const Tick_Changes& c = m_ring[tick % SNAPSHOT_RING_SIZE];
+        return tick && c.tick == tick ? &c : nullptr;
+    }
+
+    // brings ring.slot(tick) up to date. incremental when the slot holds the
+    // snapshot from SNAPSHOT_RING_SIZE ticks ago and every tick since was
+    // logged, a full rescan otherwise
+    Net_Snapshot& capture(flecs::world& world, Snapshot_Ring& ring, uint32_t tick) {
+        Net_Snapshot& out = ring.slot(tick);
+        uint32_t from = out.tick;
+
+        bool covered = from != 0 && from + SNAPSHOT_RING_SIZE == tick;
+        for (uint32_t t = from + 1; covered && t <= tick; t++)
+            covered = find(t) != nullptr;
+
+        if (!covered) {
+            capture_snapshot(world, out, tick);
+            return out;
+        }
+
+        out.tick = tick;
+        collect_touched(from, tick);
+        read_touched(world, out);
+        apply_updates(out);
+        refresh_descendants(world, out);
+
+#ifndef NDEBUG
+        if (verify_interval && tick - m_last_verify >= verify_interval) {
+            m_last_verify = tick;
+            verify(world, out);
+        }
+#endif
+        return out;
+    }
+
+private:
+    static constexpr uint32_t WHOLE_ENTITY = NET_COMPONENT_COUNT;
+
+    struct Touched {
+        uint64_t entity_id;
+        uint32_t component; // net_component_index or WHOLE_ENTITY
+        uint32_t tick;
+    };
+
+    Tick_Changes m_ring[SNAPSHOT_RING_SIZE];
+    Tick_Changes m_untracked; // before the first begin_tick
+    Tick_Changes* m_current = &m_untracked;
+    std::vector<flecs::entity> m_observers;
+
+    // scratch, reused every capture
+    std::vector<Touched> m_touched;
+    std::vector<Net_Entity_State> m_updates;
+    std::vector<uint64_t> m_erased;
+    std::vector<Net_Entity_State> m_merged;
+    std::vector<flecs::entity> m_stack;
+
+#ifndef NDEBUG
+    Net_Snapshot m_verify;
+    uint32_t m_last_verify = 0;
+
+    // what the log missed, compared at wire precision so float noise below
+    // it does not count
+    void verify(flecs::world& world, const Net_Snapshot& captured) {
+        capture_snapshot(world, m_verify, captured.tick);
+
+        uint32_t reported = 0;
+        auto report = [&](uint64_t id, const char* what) {
+            if (reported++ < 8)
+                printf("[REPLICATION] tick %u entity %llu: %s, set without modified()?\n", captured.tick, (unsigned long long)id, what);
+        };
+
+        size_t ci = 0;
+        for (const Net_Entity_State& s : m_verify.entities) {
+            while (ci < captured.entities.size() && captured.entities[ci].entity_id < s.entity_id)
+                report(captured.entities[ci++].entity_id, "no longer exists");
+
+            if (ci == captured.entities.size() || captured.entities[ci].entity_id != s.entity_id) {
+                report(s.entity_id, "never captured");
+                continue;
+            }
+
+            const Net_Entity_State& c = captured.entities[ci++];
+            if (c.parent_id != s.parent_id)
+                report(s.entity_id, "parent differs");
+
+            for_each_net_component(c, s, [&](NetComponentID id, const auto& logged, const auto& actual) {
+                if (logged.has_value() != actual.has_value() || (logged && diff_fields(*logged, *actual))) {
+                    char what[48];
+                    snprintf(what, sizeof(what), "component %u differs", static_cast<uint32_t>(id));
+                    report(s.entity_id, what);
+                }
+            });
+        }
+        for (; ci < captured.entities.size(); ci++)
+            report(captured.entities[ci].entity_id, "no longer exists");
+
+        if (reported > 8)
+            printf("[REPLICATION] tick %u: %u more differences\n", captured.tick, reported - 8);
+    }
+#endif
+
+    template<typename T>
+    void observe(flecs::world& world, NetComponentID id) {
+        m_observers.push_back(world.observer<const T>()
+            .event(flecs::OnSet)
+            .event(flecs::OnRemove)
+            .each([this, id](flecs::entity e, const T&) {
+                m_current->components.push_back({ e.id(), id });
+            }));
+    }
+
+    // every (entity, component) logged in (from, to], by entity with the
+    // newest tick last
+    void collect_touched(uint32_t from, uint32_t to) {
+        m_touched.clear();
+        for (uint32_t t = from + 1; t <= to; t++) {
+            const Tick_Changes& c = m_ring[t % SNAPSHOT_RING_SIZE];
+            for (const Net_Change& change : c.components)
+                m_touched.push_back({ change.entity_id, net_component_index(change.component), t });
+            for (uint64_t id : c.entities)
+                m_touched.push_back({ id, WHOLE_ENTITY, t });
+        }
+
+        std::sort(m_touched.begin(), m_touched.end(), [](const Touched& a, const Touched& b) {
+            if (a.entity_id != b.entity_id) return a.entity_id < b.entity_id;
+            return a.tick < b.tick;
+        });
+    }
+
+    // current state of every touched entity that is still replicated,
+    // stamped with the ticks its parts were logged at
+    void read_touched(flecs::world& world, const Net_Snapshot& out) {
+        m_updates.clear();
+        m_erased.clear();
+
+        for (size_t i = 0; i < m_touched.size(); ) {
+            uint64_t id = m_touched[i].entity_id;
+            size_t end = i;
+            while (end < m_touched.size() && m_touched[end].entity_id == id)
+                end++;
+
+            flecs::entity e(world, id);
+            const Net_Entity_State* old = find_entity(out, id);
+
+            if (!e.is_alive() || !e.has<Name_Component>()) {
+                if (old)
+                    m_erased.push_back(id);
+                i = end;
+                continue;
+            }
+
+            Net_Entity_State& s = m_updates.emplace_back();
+            if (old) {
+                std::copy(std::begin(old->component_tick), std::end(old->component_tick), s.component_tick);
+                s.changed_tick = old->changed_tick;
+            }
+            read_entity_state(e, s);
+
+            // ascending ticks, the newest wins
+            for (; i < end; i++) {
+                const Touched& t = m_touched[i];
+                if (t.component == WHOLE_ENTITY || !old)
+                    stamp_changed(s, t.tick);
+                else
+                    s.component_tick[t.component] = t.tick;
+                s.changed_tick = t.tick;
+            }
+        }
+    }
+
+    // updates in place while the set of entities stays the same, a merge
+    // when entities came or went
+    void apply_updates(Net_Snapshot& out) {
+        bool same_entities = m_erased.empty();
+        for (const Net_Entity_State& s : m_updates) {
+            if (!same_entities) break;
+            same_entities = find_entity(out, s.entity_id) != nullptr;
+        }
+
+        if (same_entities) {
+            for (Net_Entity_State& s : m_updates)
+                *find_mut(out, s.entity_id) = std::move(s);
+            return;
+        }
+
+        m_merged.clear();
+        m_merged.reserve(out.entities.size() + m_updates.size());
+
+        size_t ui = 0, ei = 0;
+        for (Net_Entity_State& s : out.entities) {
+            while (ui < m_updates.size() && m_updates[ui].entity_id < s.entity_id)
+                m_merged.push_back(std::move(m_updates[ui++]));
+
+            while (ei < m_erased.size() && m_erased[ei] < s.entity_id)
+                ei++;
+            if (ei < m_erased.size() && m_erased[ei] == s.entity_id)
+                continue;
+
+            if (ui < m_updates.size() && m_updates[ui].entity_id == s.entity_id)
+                m_merged.push_back(std::move(m_updates[ui++]));
+            else
+                m_merged.push_back(std::move(s));
+        }
+        while (ui < m_updates.size())
+            m_merged.push_back(std::move(m_updates[ui++]));
+
+        out.entities.swap(m_merged);
+    }
+
+    // children follow a moved parent without being touched themselves,
+    // only their world position for interest management changes
+    void refresh_descendants(flecs::world& world, Net_Snapshot& out) {
+        const uint32_t transform = net_component_index(net_id<Transform_Component>);
+        uint64_t last = 0;
+
+        for (const Touched& t : m_touched) {
+            if (t.component != transform && t.component != WHOLE_ENTITY) continue;
+            if (t.entity_id == last) continue;
+            last = t.entity_id;
+
+            flecs::entity e(world, t.entity_id);
+            if (!e.is_alive()) continue;
+
+            m_stack.clear();
+            e.children([&](flecs::entity child) { m_stack.push_back(child); });
+
+            while (!m_stack.empty()) {
+                flecs::entity child = m_stack.back();
+                m_stack.pop_back();
+
+                Net_Entity_State* s = find_mut(out, child.id());
+                const Transform_Component* tc = child.try_get<Transform_Component>();
+                if (s && tc)
+                    s->world_position = vec3(tc->world_transform[3]);
+
+                child.children([&](flecs::entity grandchild) { m_stack.push_back(grandchild); });
+            }
+        }
+    }
+
+    static Net_Entity_State* find_mut(Net_Snapshot& snapshot, uint64_t entity_id) {
+        return const_cast<Net_Entity_State*>(find_entity(snapshot, entity_id));
+    }
+};
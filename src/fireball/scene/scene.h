@@ -6,6 +6,7 @@
 
 #include <functional>
 #include <string>
+#include <vector>
 
 class Vk_Backend;
 
@@ -31,6 +32,26 @@ public:
     Vk_Backend* renderer;
 
 private:
+    // entities whose Physics_Component still needs a body
+    std::vector<flecs::entity_t> m_pending_bodies;
+    std::vector<flecs::entity_t> m_batch_entities;
+    std::vector<Physics_Info> m_batch_infos;
+    std::vector<Physics_Handle> m_batch_handles;
+
+    std::vector<uint64_t> m_batch_user_data;
+
+    // bodies awake at the last step we synced, the only ones whose transforms are written
+    uint64_t m_synced_step = UINT64_MAX;
+    std::vector<Physics_Body_State> m_active_bodies;
+    std::vector<flecs::entity_t> m_moving;
+    std::vector<flecs::entity_t> m_was_moving;
+
+    std::vector<Physics_Event> m_physics_events;
+
+    void create_pending_bodies();
+    void sync_physics_bodies();
+    void drain_physics_events();
+
     // void register_physics_systems();
     // void register_transform_systems();
     // void register_render_systems();
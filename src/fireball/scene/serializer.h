@@ -3,8 +3,19 @@
 #include "asset/model_manager.h"
 #include "components.h"
 
+#include "fireball/networking/net_buffer.h"
+#include "fireball/networking/network_protocol.h"
+#include "fireball/scene/net_id_map.h"
 #include "fireball/scene/scene.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 
 // enum class Ecs_Message : uint8_t {
@@ -56,44 +67,253 @@ struct ByteReader {
     }
 };
 
+// bit level packing on top of the byte streams, used inside a component's
+// bytes. a writer must be flushed, the reader drops the padding of its last byte
+struct BitWriter {
+    ByteWriter& w;
+    uint64_t scratch = 0;
+    uint32_t scratch_bits = 0;
+
+    explicit BitWriter(ByteWriter& writer) : w(writer) {}
+
+    void write_bits(uint32_t value, uint32_t bits) {
+        scratch |= (uint64_t(value) & ((1ull << bits) - 1)) << scratch_bits;
+        scratch_bits += bits;
+        while (scratch_bits >= 8) {
+            w.data.push_back(static_cast<uint8_t>(scratch));
+            scratch >>= 8;
+            scratch_bits -= 8;
+        }
+    }
+
+    void write_bool(bool b) { write_bits(b ? 1 : 0, 1); }
+    void write_float(float f) { write_bits(std::bit_cast<uint32_t>(f), 32); }
+
+    void flush() {
+        if (scratch_bits)
+            w.data.push_back(static_cast<uint8_t>(scratch));
+        scratch = 0;
+        scratch_bits = 0;
+    }
+};
+
+struct BitReader {
+    ByteReader& r;
+    uint64_t scratch = 0;
+    uint32_t scratch_bits = 0;
+
+    explicit BitReader(ByteReader& reader) : r(reader) {}
+
+    bool read_bits(uint32_t& out, uint32_t bits) {
+        while (scratch_bits < bits) {
+            uint8_t byte;
+            if (!r.read(byte)) return false;
+            scratch |= uint64_t(byte) << scratch_bits;
+            scratch_bits += 8;
+        }
+        out = static_cast<uint32_t>(scratch & ((1ull << bits) - 1));
+        scratch >>= bits;
+        scratch_bits -= bits;
+        return true;
+    }
+
+    bool read_bool(bool& out) {
+        uint32_t v;
+        if (!read_bits(v, 1)) return false;
+        out = v != 0;
+        return true;
+    }
+
+    bool read_float(float& out) {
+        uint32_t v;
+        if (!read_bits(v, 32)) return false;
+        out = std::bit_cast<float>(v);
+        return true;
+    }
+};
+
+// fixed point over [min, max] in steps of precision
+struct Quantized_Range {
+    float min;
+    float max;
+    float precision;
+
+    constexpr uint32_t steps() const { return static_cast<uint32_t>((max - min) / precision + 0.5f); }
+    constexpr uint32_t bits() const { return std::bit_width(steps()); }
+
+    bool contains(float v) const { return v >= min && v <= max; }
+    uint32_t quantize(float v) const { return std::min(static_cast<uint32_t>((std::clamp(v, min, max) - min) / precision + 0.5f), steps()); }
+    float dequantize(uint32_t q) const { return min + q * precision; }
+};
+
+// smallest three, the largest component is dropped and rebuilt from unit
+// length. the remaining three are within +-1/sqrt(2)
+struct Quantized_Quat {
+    uint32_t largest;
+    uint32_t q[3];
+
+    bool operator==(const Quantized_Quat&) const = default;
+};
+
+inline Quantized_Quat quantize_quat(quat q, uint32_t bits) {
+    constexpr float range = 0.70710678f;
+    const float scale = float((1u << bits) - 1);
+
+    q = glm::normalize(q);
+
+    uint32_t largest = 0;
+    for (uint32_t i = 1; i < 4; i++) {
+        if (std::abs(q[i]) > std::abs(q[largest]))
+            largest = i;
+    }
+
+    // q and -q are the same rotation, keep the dropped one positive
+    if (q[largest] < 0.0f)
+        q = -q;
+
+    Quantized_Quat out = { largest };
+    for (uint32_t i = 0, j = 0; i < 4; i++) {
+        if (i == largest) continue;
+        float n = (std::clamp(q[i], -range, range) + range) / (2.0f * range);
+        out.q[j++] = static_cast<uint32_t>(n * scale + 0.5f);
+    }
+    return out;
+}
+
+inline quat dequantize_quat(const Quantized_Quat& qq, uint32_t bits) {
+    constexpr float range = 0.70710678f;
+    const float scale = float((1u << bits) - 1);
+
+    quat q;
+    float sum = 0.0f;
+    for (uint32_t i = 0, j = 0; i < 4; i++) {
+        if (i == qq.largest) continue;
+        q[i] = (qq.q[j++] / scale) * 2.0f * range - range;
+        sum += q[i] * q[i];
+    }
+    q[qq.largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+    return glm::normalize(q);
+}
+
+inline void write_quat(BitWriter& w, const Quantized_Quat& q, uint32_t bits) {
+    w.write_bits(q.largest, 2);
+    for (uint32_t c : q.q)
+        w.write_bits(c, bits);
+}
+
+inline bool read_quat(BitReader& r, Quantized_Quat& q, uint32_t bits) {
+    if (!r.read_bits(q.largest, 2)) return false;
+    for (uint32_t& c : q.q)
+        if (!r.read_bits(c, bits)) return false;
+    return true;
+}
+
+// components specialize this to declare how they are quantized on the wire,
+// both ends must be built with the same values
+template<typename T>
+struct Net_Precision;
+
+// every replicated component is written as a list of fields, a field
+// mask selects which of them are on the wire. full serialize writes all
+// of them, deltas only the ones that differ from the baseline
+constexpr uint8_t NET_FIELDS_ALL = 0xFF;
+
+inline uint8_t diff_fields(const Name_Component& a, const Name_Component& b) {
+    return a.string != b.string ? 1 : 0;
+}
+
+inline void serialize_fields(ByteWriter& w, const Name_Component& n, uint8_t mask) {
+    if (mask & 1) w.write_string(n.string);
+}
+
+inline bool deserialize_fields(ByteReader& r, Name_Component& n, uint8_t mask) {
+    if (mask & 1 && !r.read_string(n.string)) return false;
+    return true;
+}
+
+inline uint8_t diff_fields(const Server_Model_Component& a, const Server_Model_Component& b) {
+    return a.model_name != b.model_name ? 1 : 0;
+}
+
+inline void serialize_fields(ByteWriter& w, const Server_Model_Component& m, uint8_t mask) {
+    if (mask & 1) w.write_string(m.model_name);
+}
+
+inline bool deserialize_fields(ByteReader& r, Server_Model_Component& m, uint8_t mask) {
+    if (mask & 1 && !r.read_string(m.model_name)) return false;
+    return true;
+}
+
+enum Light_Field : uint8_t {
+    Light_Type      = 1 << 0,
+    Light_Color     = 1 << 1,
+    Light_Intensity = 1 << 2,
+    Light_Range     = 1 << 3,
+    Light_Direction = 1 << 4,
+    Light_Inner     = 1 << 5,
+    Light_Outer     = 1 << 6,
+    Light_Enabled   = 1 << 7,
+};
+
+inline uint8_t diff_fields(const Light_Component& a, const Light_Component& b) {
+    uint8_t mask = 0;
+    if (a.type != b.type)                         mask |= Light_Type;
+    if (a.color != b.color)                       mask |= Light_Color;
+    if (a.intensity != b.intensity)               mask |= Light_Intensity;
+    if (a.range != b.range)                       mask |= Light_Range;
+    if (a.direction != b.direction)               mask |= Light_Direction;
+    if (a.inner_cone_angle != b.inner_cone_angle) mask |= Light_Inner;
+    if (a.outer_cone_angle != b.outer_cone_angle) mask |= Light_Outer;
+    if (a.enabled != b.enabled)                   mask |= Light_Enabled;
+    return mask;
+}
+
+inline void serialize_fields(ByteWriter& w, const Light_Component& l, uint8_t mask) {
+    if (mask & Light_Type)      w.write(l.type);
+    if (mask & Light_Color)     w.write(l.color);
+    if (mask & Light_Intensity) w.write(l.intensity);
+    if (mask & Light_Range)     w.write(l.range);
+    if (mask & Light_Direction) w.write(l.direction);
+    if (mask & Light_Inner)     w.write(l.inner_cone_angle);
+    if (mask & Light_Outer)     w.write(l.outer_cone_angle);
+    if (mask & Light_Enabled)   w.write(l.enabled);
+}
+
+inline bool deserialize_fields(ByteReader& r, Light_Component& l, uint8_t mask) {
+    if (mask & Light_Type      && !r.read(l.type)) return false;
+    if (mask & Light_Color     && !r.read(l.color)) return false;
+    if (mask & Light_Intensity && !r.read(l.intensity)) return false;
+    if (mask & Light_Range     && !r.read(l.range)) return false;
+    if (mask & Light_Direction && !r.read(l.direction)) return false;
+    if (mask & Light_Inner     && !r.read(l.inner_cone_angle)) return false;
+    if (mask & Light_Outer     && !r.read(l.outer_cone_angle)) return false;
+    if (mask & Light_Enabled   && !r.read(l.enabled)) return false;
+    l.dirty = true;
+    return true;
+}
+
 inline void serialize(ByteWriter& w, const Name_Component& n) {
-    w.write_string(n.string);
+    serialize_fields(w, n, NET_FIELDS_ALL);
 }
 
 inline bool deserialize(ByteReader& r, Name_Component& n) {
-    return r.read_string(n.string);
+    return deserialize_fields(r, n, NET_FIELDS_ALL);
 }
 
 inline void serialize(ByteWriter& w, const Server_Model_Component& m) {
-    w.write_string(m.model_name);
+    serialize_fields(w, m, NET_FIELDS_ALL);
 }
 
 inline bool deserialize(ByteReader& r, Server_Model_Component& m) {
-    return r.read_string(m.model_name);
+    return deserialize_fields(r, m, NET_FIELDS_ALL);
 }
 
 inline void serialize(ByteWriter& w, const Light_Component& l) {
-    w.write(l.type);
-    w.write(l.color);
-    w.write(l.intensity);
-    w.write(l.range);
-    w.write(l.direction);
-    w.write(l.inner_cone_angle);
-    w.write(l.outer_cone_angle);
-    w.write(l.enabled);
+    serialize_fields(w, l, NET_FIELDS_ALL);
 }
 
 inline bool deserialize(ByteReader& r, Light_Component& l) {
-    if (!r.read(l.type)) return false;
-    if (!r.read(l.color)) return false;
-    if (!r.read(l.intensity)) return false;
-    if (!r.read(l.range)) return false;
-    if (!r.read(l.direction)) return false;
-    if (!r.read(l.inner_cone_angle)) return false;
-    if (!r.read(l.outer_cone_angle)) return false;
-    if (!r.read(l.enabled)) return false;
-    l.dirty = true;
-    return true;
+    return deserialize_fields(r, l, NET_FIELDS_ALL);
 }
 
 //   [uint64 entity_id]
@@ -104,28 +324,306 @@ inline bool deserialize(ByteReader& r, Light_Component& l) {
 //     [uint16 byte_length]
 //     [data...]
 
-enum class NetComponentID : uint8_t {
-    Transform = 1,
-    Name = 2,
-    ServerModel = 3,
-    Light = 4,
+// wire id of a replicated component, assigned in Net_Registry
+enum class NetComponentID : uint8_t {};
+
+enum Transform_Field : uint8_t {
+    Transform_Position = 1 << 0,
+    Transform_Rotation = 1 << 1,
+    Transform_Scale    = 1 << 2,
 };
 
-inline void serialize(ByteWriter& w, const Transform_Component& t) {
-    w.write(t.position);
-    w.write(t.rotation);
-    w.write(t.scale);
+template<>
+struct Net_Precision<Transform_Component> {
+    // world bounds per axis, positions outside are sent as raw floats
+    static constexpr Quantized_Range position[3] = {
+        { -1024.0f, 1024.0f, 0.002f },
+        {  -256.0f,  256.0f, 0.002f },
+        { -1024.0f, 1024.0f, 0.002f },
+    };
+    static constexpr uint32_t rotation_bits = 10;
+    // scales outside, negative ones included, are sent as raw floats
+    static constexpr Quantized_Range scale = { 0.0f, 128.0f, 0.001f };
+};
+
+// transform as it is on the wire, diffing is done on this so changes below
+// the declared precision are never sent
+struct Net_Transform {
+    enum Scale_Mode : uint32_t { Scale_One = 0, Scale_Uniform = 1, Scale_Full = 2, Scale_Raw = 3 };
+
+    bool position_in_bounds;
+    uint32_t position[3];
+    vec3 raw_position;
+    Quantized_Quat rotation;
+    uint32_t scale_mode;
+    uint32_t scale[3];
+    vec3 raw_scale;
+
+    bool same_position(const Net_Transform& o) const {
+        if (position_in_bounds != o.position_in_bounds) return false;
+        if (!position_in_bounds) return raw_position == o.raw_position;
+        return position[0] == o.position[0] && position[1] == o.position[1] && position[2] == o.position[2];
+    }
+
+    bool same_scale(const Net_Transform& o) const {
+        if (scale_mode != o.scale_mode) return false;
+        if (scale_mode == Scale_Raw) return raw_scale == o.raw_scale;
+        return scale[0] == o.scale[0] && scale[1] == o.scale[1] && scale[2] == o.scale[2];
+    }
+};
+
+inline Net_Transform quantize_transform(const Transform_Component& t) {
+    using P = Net_Precision<Transform_Component>;
+
+    Net_Transform n = {};
+    n.position_in_bounds = true;
+    for (int i = 0; i < 3; i++) {
+        n.position_in_bounds &= P::position[i].contains(t.position[i]);
+        n.position[i] = P::position[i].quantize(t.position[i]);
+    }
+    n.raw_position = t.position;
+
+    n.rotation = quantize_quat(euler_to_quat(t.rotation), P::rotation_bits);
+
+    bool scale_in_bounds = true;
+    for (int i = 0; i < 3; i++) {
+        scale_in_bounds &= P::scale.contains(t.scale[i]);
+        n.scale[i] = P::scale.quantize(t.scale[i]);
+    }
+    n.raw_scale = t.scale;
+
+    if (t.scale == vec3(1.0f))
+        n.scale_mode = Net_Transform::Scale_One;
+    else if (!scale_in_bounds)
+        n.scale_mode = Net_Transform::Scale_Raw;
+    else if (n.scale[0] == n.scale[1] && n.scale[0] == n.scale[2])
+        n.scale_mode = Net_Transform::Scale_Uniform;
+    else
+        n.scale_mode = Net_Transform::Scale_Full;
+
+    return n;
 }
 
-inline bool deserialize(ByteReader& r, Transform_Component& t) {
-    if (!r.read(t.position)) return false;
-    if (!r.read(t.rotation)) return false;
-    if (!r.read(t.scale)) return false;
+inline uint8_t diff_fields(const Net_Transform& a, const Net_Transform& b) {
+    uint8_t mask = 0;
+    if (!a.same_position(b))      mask |= Transform_Position;
+    if (a.rotation != b.rotation) mask |= Transform_Rotation;
+    if (!a.same_scale(b))         mask |= Transform_Scale;
+    return mask;
+}
+
+inline uint8_t diff_fields(const Transform_Component& a, const Transform_Component& b) {
+    return diff_fields(quantize_transform(a), quantize_transform(b));
+}
+
+//   position  [1 bit in_bounds] then quantized axes, or 3 raw floats
+//   rotation  [2 bit largest][3 * rotation_bits]
+//   scale     [2 bit mode] then nothing, one or three quantized values, or 3 raw floats
+inline void serialize_fields(ByteWriter& w, const Net_Transform& n, uint8_t mask) {
+    using P = Net_Precision<Transform_Component>;
+
+    BitWriter bw(w);
+
+    if (mask & Transform_Position) {
+        bw.write_bool(n.position_in_bounds);
+        for (int i = 0; i < 3; i++) {
+            if (n.position_in_bounds)
+                bw.write_bits(n.position[i], P::position[i].bits());
+            else
+                bw.write_float(n.raw_position[i]);
+        }
+    }
+
+    if (mask & Transform_Rotation)
+        write_quat(bw, n.rotation, P::rotation_bits);
+
+    if (mask & Transform_Scale) {
+        bw.write_bits(n.scale_mode, 2);
+        if (n.scale_mode == Net_Transform::Scale_Raw) {
+            for (int i = 0; i < 3; i++)
+                bw.write_float(n.raw_scale[i]);
+        }
+        else {
+            uint32_t count = n.scale_mode == Net_Transform::Scale_Full ? 3 : n.scale_mode;
+            for (uint32_t i = 0; i < count; i++)
+                bw.write_bits(n.scale[i], P::scale.bits());
+        }
+    }
+
+    bw.flush();
+}
+
+inline void serialize_fields(ByteWriter& w, const Transform_Component& t, uint8_t mask) {
+    serialize_fields(w, quantize_transform(t), mask);
+}
+
+inline bool deserialize_fields(ByteReader& r, Transform_Component& t, uint8_t mask) {
+    using P = Net_Precision<Transform_Component>;
+
+    BitReader br(r);
+
+    if (mask & Transform_Position) {
+        bool in_bounds;
+        if (!br.read_bool(in_bounds)) return false;
+        for (int i = 0; i < 3; i++) {
+            if (in_bounds) {
+                uint32_t q;
+                if (!br.read_bits(q, P::position[i].bits())) return false;
+                t.position[i] = P::position[i].dequantize(q);
+            }
+            else if (!br.read_float(t.position[i])) return false;
+        }
+    }
+
+    if (mask & Transform_Rotation) {
+        Quantized_Quat q;
+        if (!read_quat(br, q, P::rotation_bits)) return false;
+        t.rotation = quat_to_euler(dequantize_quat(q, P::rotation_bits));
+    }
+
+    if (mask & Transform_Scale) {
+        uint32_t mode;
+        if (!br.read_bits(mode, 2)) return false;
+
+        if (mode == Net_Transform::Scale_One) {
+            t.scale = vec3(1.0f);
+        }
+        else if (mode == Net_Transform::Scale_Raw) {
+            for (int i = 0; i < 3; i++)
+                if (!br.read_float(t.scale[i])) return false;
+        }
+        else {
+            uint32_t count = mode == Net_Transform::Scale_Full ? 3 : 1;
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t q;
+                if (!br.read_bits(q, P::scale.bits())) return false;
+                t.scale[i] = P::scale.dequantize(q);
+            }
+            if (mode == Net_Transform::Scale_Uniform)
+                t.scale = vec3(t.scale.x);
+        }
+    }
+
     t.dirty = true; // mark dirty so transform system recalculates
     t.updated = false;
     return true;
 }
 
+inline void serialize(ByteWriter& w, const Transform_Component& t) {
+    serialize_fields(w, t, NET_FIELDS_ALL);
+}
+
+inline bool deserialize(ByteReader& r, Transform_Component& t) {
+    return deserialize_fields(r, t, NET_FIELDS_ALL);
+}
+
+// raw copy path: a trivially copyable component without a quantized wire
+// format goes on the wire as its bytes when sent whole, one memcpy each way.
+// net_received fixes up local only state after such a copy
+template<typename T>
+constexpr bool net_raw_copy = std::is_trivially_copyable_v<T> && !requires { sizeof(Net_Precision<T>); };
+
+template<typename T>
+inline void net_received(T&) {}
+
+inline void net_received(Light_Component& l) {
+    l.dirty = true;
+}
+
+template<typename T>
+inline void net_write(ByteWriter& w, const T& c) {
+    if constexpr (net_raw_copy<T>)
+        w.write(c);
+    else
+        serialize(w, c);
+}
+
+template<typename T>
+inline bool net_read(ByteReader& r, T& c) {
+    if constexpr (net_raw_copy<T>) {
+        if (!r.read(c)) return false;
+        net_received(c);
+        return true;
+    }
+    else {
+        return deserialize(r, c);
+    }
+}
+
+template<typename T, uint8_t Id>
+struct Net_Registration {
+    using Type = T;
+    static constexpr NetComponentID id = NetComponentID(Id);
+};
+
+// every replicated component, registered once with its wire id. snapshots,
+// deltas, the replication log and the client appliers are all generated
+// from this list, in this order
+template<typename... R>
+struct Net_Component_Registry {
+    static constexpr uint32_t count = sizeof...(R);
+    static constexpr uint8_t NONE = 0xFF;
+
+    // one optional per component, what Net_Entity_State holds
+    using States = std::tuple<std::optional<typename R::Type>...>;
+
+    // wire id -> position in the list
+    static constexpr std::array<uint8_t, 256> index_table = [] {
+        std::array<uint8_t, 256> table;
+        table.fill(NONE);
+        uint8_t i = 0;
+        ((table[static_cast<uint8_t>(R::id)] = i++), ...);
+        return table;
+    }();
+
+    static constexpr bool ids_unique() {
+        uint32_t found = 0;
+        for (uint8_t i : index_table)
+            found += i != NONE;
+        return found == count && index_table[0] == NONE;
+    }
+    static_assert(ids_unique(), "wire ids must be unique and not 0");
+
+    template<typename T>
+    static constexpr uint32_t index_of() {
+        uint32_t i = 0, found = count;
+        ((std::is_same_v<T, typename R::Type> ? (found = i, i++) : i++), ...);
+        return found;
+    }
+
+    template<typename T>
+    static constexpr NetComponentID id_of() {
+        static_assert(index_of<T>() < count, "component is not registered");
+        NetComponentID id {};
+        ((std::is_same_v<T, typename R::Type> ? (id = R::id, 0) : 0), ...);
+        return id;
+    }
+
+    // f.template operator()<T>(NetComponentID) for every component
+    template<typename F>
+    static void for_each(F&& f) {
+        (f.template operator()<typename R::Type>(R::id), ...);
+    }
+};
+
+using Net_Registry = Net_Component_Registry<
+    Net_Registration<Transform_Component,    1>,
+    Net_Registration<Name_Component,         2>,
+    Net_Registration<Server_Model_Component, 3>,
+    Net_Registration<Light_Component,        4>
+>;
+
+constexpr uint32_t NET_COMPONENT_COUNT = Net_Registry::count;
+
+template<typename T>
+constexpr NetComponentID net_id = Net_Registry::id_of<T>();
+
+// position of a wire id in the registry, NET_COMPONENT_COUNT if unknown
+constexpr uint32_t net_component_index(NetComponentID id) {
+    uint8_t i = Net_Registry::index_table[static_cast<uint8_t>(id)];
+    return i == Net_Registry::NONE ? NET_COMPONENT_COUNT : i;
+}
+
 struct NetEntity {
     uint64_t entity_id;
     uint64_t parent_id;
@@ -137,171 +635,459 @@ struct NetEntity {
     std::vector<NetComponent> components;
 };
 
-static std::vector<uint8_t> serialize_entity(flecs::entity e) {
-    ByteWriter w;
+template<typename T>
+static void back_patch(ByteWriter& w, size_t offset, const T& val) {
+    memcpy(w.data.data() + offset, &val, sizeof(T));
+}
 
-    w.write(e.id());
+// full snapshots are written straight into one arena that is reused from
+// call to call, so once warm a snapshot does not allocate. lengths and
+// counts are reserved as placeholders and patched once known, no entity or
+// component is built in a buffer of its own and copied after.
+// owned by whoever builds snapshots, must not outlive the world
+struct Snapshot_Writer {
+    ByteWriter arena;
+    std::vector<flecs::entity> stack;     // hierarchy walk
+    std::vector<uint32_t> entity_offsets; // start of every entity record in the arena
 
-    uint64_t parent_id = 0;
-    if (e.has(flecs::ChildOf, flecs::Wildcard)) {
-        parent_id = e.target(flecs::ChildOf).id();
-    }
-    w.write(parent_id);
+    // entities without a parent, cached so every snapshot does not rebuild it
+    flecs::query<const Name_Component> roots;
 
-    std::vector<std::pair<NetComponentID, std::vector<uint8_t>>> comps;
+    explicit Snapshot_Writer(flecs::world& world)
+        : roots(world.query_builder<const Name_Component>()
+            .with(flecs::ChildOf, flecs::Wildcard).oper(flecs::Not)
+            .cached()
+            .build()) {}
 
-    auto try_serialize = [&]<typename T>(NetComponentID id) {
-        if (e.has<T>()) {
-            ByteWriter cw;
-            serialize(cw, *e.try_get<T>());
-            comps.push_back({ id, std::move(cw.data) });
+    // appends [uint32 entity_size][entity] per entity to the arena, ancestors
+    // before their children. filter: sorted entity ids to include, the
+    // ancestors of an included entity must be included too, nullptr is all
+    uint32_t write_entities(const std::vector<uint64_t>* filter) {
+        entity_offsets.clear();
+        stack.clear();
+
+        roots.each([&](flecs::entity e, const Name_Component&) {
+            stack.push_back(e);
+        });
+        std::reverse(stack.begin(), stack.end());
+
+        while (!stack.empty()) {
+            flecs::entity e = stack.back();
+            stack.pop_back();
+
+            if (filter && !std::binary_search(filter->begin(), filter->end(), e.id()))
+                continue; // so are its children
+
+            entity_offsets.push_back(static_cast<uint32_t>(arena.data.size()));
+            write_entity(e);
+
+            // reversed so they pop in flecs order
+            size_t first_child = stack.size();
+            e.children([&](flecs::entity child) {
+                stack.push_back(child);
+            });
+            std::reverse(stack.begin() + first_child, stack.end());
         }
-    };
 
-    try_serialize.template operator()<Transform_Component>(NetComponentID::Transform);
-    try_serialize.template operator()<Name_Component>(NetComponentID::Name);
-    try_serialize.template operator()<Server_Model_Component>(NetComponentID::ServerModel);
-    try_serialize.template operator()<Light_Component>(NetComponentID::Light);
+        return static_cast<uint32_t>(entity_offsets.size());
+    }
+
+    //   [uint32 entity_size]
+    //   [uint64 entity_id]
+    //   [uint64 parent_id]  (0 if no parent)
+    //   [uint8  component_count]
+    //   for each component:
+    //     [uint8  NetComponentID]
+    //     [uint16 byte_length]
+    //     [data...]
+    void write_entity(flecs::entity e) {
+        ByteWriter& w = arena;
 
-    w.write(static_cast<uint8_t>(comps.size()));
+        size_t size_offset = w.data.size();
+        w.write(uint32_t(0));
 
-    for (auto& [id, data] : comps) {
-        w.write(id);
-        w.write(static_cast<uint16_t>(data.size()));
-        w.data.insert(w.data.end(), data.begin(), data.end());
+        w.write(e.id());
+        flecs::entity parent = e.parent();
+        w.write(parent ? parent.id() : uint64_t(0));
+
+        size_t count_offset = w.data.size();
+        uint8_t count = 0;
+        w.write(count);
+
+        Net_Registry::for_each([&]<typename T>(NetComponentID id) {
+            const T* c = e.try_get<T>();
+            if (!c) return;
+
+            w.write(id);
+            size_t length_offset = w.data.size();
+            w.write(uint16_t(0));
+
+            net_write(w, *c);
+            back_patch(w, length_offset, static_cast<uint16_t>(w.data.size() - length_offset - sizeof(uint16_t)));
+            count++;
+        });
+
+        back_patch(w, count_offset, count);
+        back_patch(w, size_offset, static_cast<uint32_t>(w.data.size() - size_offset - sizeof(uint32_t)));
     }
+};
+
+//   [uint32 entity_count]
+//   [uint32 entity_size][entity] * entity_count
+// points into the writer's arena, valid until its next snapshot
+static std::span<const uint8_t> serialize_scene(Snapshot_Writer& writer, const std::vector<uint64_t>* filter = nullptr) {
+    writer.arena.data.clear();
+    writer.arena.write(uint32_t(0));
 
-    return w.data;
+    back_patch(writer.arena, 0, writer.write_entities(filter));
+    return writer.arena.data;
 }
 
-static std::vector<uint8_t> serialize_scene(flecs::world& world) {
-    ByteWriter w;
+// the same entities split into chunks of at most chunk_size bytes, an entity
+// bigger than that gets a chunk of its own. hierarchy order is kept across
+// chunks so every chunk can be applied as soon as it arrives. chunks are
+// framed straight from the arena into pool buffers, ready to send
+static Snapshot_Stream serialize_scene_chunked(Snapshot_Writer& writer, const std::vector<uint64_t>* filter, uint32_t chunk_size) {
+    Snapshot_Stream stream;
 
-    std::vector<std::vector<uint8_t>> entity_bufs;
+    writer.arena.data.clear();
+    uint32_t entity_count = writer.write_entities(filter);
+    stream.manifest.entity_count = entity_count;
 
-    // in hierarchy order
-    std::function<void(flecs::entity)> visit = [&](flecs::entity e) {
-        entity_bufs.push_back(serialize_entity(e));
-        e.children([&](flecs::entity child) {
-            visit(child);
-        });
-    };
+    const uint8_t* records = writer.arena.data.data();
+    const std::vector<uint32_t>& offsets = writer.entity_offsets;
+    uint32_t end = static_cast<uint32_t>(writer.arena.data.size());
 
-    world.query_builder<Name_Component>()
-        .with(flecs::ChildOf, flecs::Wildcard).oper(flecs::Not)
-        .build()
-        .each([&](Entity e, Name_Component& nc) {
-            visit(e);
-            printf("serializing %s\n", nc.c_str());
-        });
+    // records are contiguous in the arena, a chunk is a header plus a run of them
+    auto record_end = [&](uint32_t i) { return i + 1 < entity_count ? offsets[i + 1] : end; };
+
+    Snapshot_Chunk_Header header = {};
+    for (uint32_t first = 0; first < entity_count; ) {
+        uint32_t last = first + 1;
+        while (last < entity_count && record_end(last) - offsets[first] + sizeof(header) <= chunk_size)
+            last++;
 
-    w.write(static_cast<uint32_t>(entity_bufs.size()));
-    for (auto& buf : entity_bufs) {
-        w.write(static_cast<uint32_t>(buf.size()));
-        w.data.insert(w.data.end(), buf.begin(), buf.end());
+        uint32_t begin = offsets[first];
+        uint32_t stop = record_end(last - 1);
+        header.entity_count = last - first;
+
+        uint32_t size = static_cast<uint32_t>(sizeof(header)) + stop - begin;
+        Net_Buffer* chunk = begin_frame(Net_Msg::SnapshotChunk, size);
+        memcpy(chunk->data() + NET_HEADER_SIZE, &header, sizeof(header));
+        memcpy(chunk->data() + NET_HEADER_SIZE + sizeof(header), records + begin, stop - begin);
+        stream.chunks.push_back(chunk);
+        stream.manifest.total_bytes += size;
+
+        header.index++;
+        first = last;
     }
 
-    return w.data;
+    stream.manifest.chunk_count = static_cast<uint32_t>(stream.chunks.size());
+    return stream;
 }
 
 #ifdef FIREBALL_CLIENT
 
-static bool apply_component(Entity e, NetComponentID id, ByteReader& r) {
-    switch (id) {
-        case NetComponentID::Transform: {
-            Transform_Component t;
-            if (!deserialize(r, t)) return false;
-            e.set<Transform_Component>(t);
-            return true;
-        }
-        case NetComponentID::Name: {
-            Name_Component n;
-            if (!deserialize(r, n)) return false;
-            e.set<Name_Component>(n);
-            return true;
-        }
-        case NetComponentID::ServerModel: {
-            Server_Model_Component m;
-            if (!deserialize(r, m)) return false;
-            e.set<Model_Component>({ Model_Manager::load_model(m.model_name) });
-            return true;
+// how a replicated component lands in the world on the client. a malformed
+// record must leave the component as it was: raw copies are read straight
+// into the entity's storage once their size is checked, everything else is
+// read into a copy first
+template<typename T>
+struct Net_Apply {
+    using Stored = T; // what the entity holds
+
+    static bool read(Entity e, ByteReader& r) {
+        if constexpr (net_raw_copy<T>) {
+            if (r.remaining < sizeof(T)) return false;
+            net_read(r, e.ensure<T>());
         }
-        case NetComponentID::Light: {
-            Light_Component l;
-            if (!deserialize(r, l)) return false;
-            e.set<Light_Component>(l);
-            return true;
+        else {
+            // starts from the current value, local only state is kept
+            const T* current = e.try_get<T>();
+            T c = current ? *current : T{};
+            if (!net_read(r, c)) return false;
+            e.ensure<T>() = std::move(c);
         }
-        default:
-            return false;
+        e.modified<T>();
+        return true;
     }
-}
 
-static bool deserialize_entity(Scene& scene, ByteReader& r, std::unordered_map<uint64_t, flecs::entity>& id_map) {
-    uint64_t server_id, parent_server_id;
-    if (!r.read(server_id))        return false;
-    if (!r.read(parent_server_id)) return false;
+    static void set(Entity e, const T& c) {
+        e.set<T>(c);
+    }
 
-    flecs::entity e;
-    auto it = id_map.find(server_id);
-    if (it != id_map.end()) {
-        e = it->second;
-    } else {
-        e = scene.create_entity();
-        id_map[server_id] = e;
+    static void remove(Entity e) {
+        e.remove<T>();
     }
+};
 
-    if (parent_server_id != 0) {
-        auto pit = id_map.find(parent_server_id);
-        if (pit != id_map.end()) {
-            e.add(flecs::ChildOf, pit->second);
-        }
+// the client holds the loaded model, not the name
+template<>
+struct Net_Apply<Server_Model_Component> {
+    using Stored = Model_Component;
+
+    static bool read(Entity e, ByteReader& r) {
+        Server_Model_Component m;
+        if (!net_read(r, m)) return false;
+        set(e, m);
+        return true;
+    }
+
+    static void set(Entity e, const Server_Model_Component& m) {
+        e.set<Model_Component>({ Model_Manager::load_model(m.model_name) });
     }
 
-    uint8_t comp_count;
-    if (!r.read(comp_count)) return false;
+    static void remove(Entity e) {
+        e.remove<Model_Component>();
+    }
+};
 
-    for (uint8_t i = 0; i < comp_count; i++) {
+using Net_Apply_Fn = bool (*)(Entity, ByteReader&);
+
+// indexed by wire id, unknown ids are null
+static const std::array<Net_Apply_Fn, 256> g_net_apply = [] {
+    std::array<Net_Apply_Fn, 256> table = {};
+    Net_Registry::for_each([&]<typename T>(NetComponentID id) {
+        table[static_cast<uint8_t>(id)] = &Net_Apply<T>::read;
+    });
+    return table;
+}();
+
+static bool apply_component(Entity e, NetComponentID id, ByteReader& r) {
+    Net_Apply_Fn apply = g_net_apply[static_cast<uint8_t>(id)];
+    return apply && apply(e, r);
+}
+
+// an entity record of a full snapshot, checked but not applied yet
+struct Incoming_Entity {
+    uint64_t server_id;
+    uint64_t parent_server_id;
+    uint32_t signature; // bit per net_component_index
+    uint8_t component_count;
+    const uint8_t* components;
+    uint32_t components_size;
+    flecs::entity local;
+    bool created;
+};
+
+static_assert(NET_COMPONENT_COUNT < 32, "signature is a 32 bit mask");
+
+static bool parse_entity(ByteReader& r, Incoming_Entity& in) {
+    if (!r.read(in.server_id))        return false;
+    if (!r.read(in.parent_server_id)) return false;
+    if (!r.read(in.component_count))  return false;
+
+    in.signature = 0;
+    in.components = r.ptr;
+    in.components_size = static_cast<uint32_t>(r.remaining);
+    in.local = flecs::entity();
+    in.created = false;
+
+    for (uint8_t i = 0; i < in.component_count; i++) {
         NetComponentID comp_id;
         uint16_t comp_size;
         if (!r.read(comp_id))   return false;
         if (!r.read(comp_size)) return false;
         if (r.remaining < comp_size) return false;
+        if (!g_net_apply[static_cast<uint8_t>(comp_id)]) return false;
+
+        r.ptr       += comp_size;
+        r.remaining -= comp_size;
+        in.signature |= 1u << net_component_index(comp_id);
+    }
+
+    return true;
+}
+
+static bool apply_components(const Incoming_Entity& in) {
+    ByteReader r(in.components, in.components_size);
+
+    for (uint8_t i = 0; i < in.component_count; i++) {
+        NetComponentID comp_id;
+        uint16_t comp_size;
+        r.read(comp_id);
+        r.read(comp_size);
 
         ByteReader cr(r.ptr, comp_size);
         r.ptr       += comp_size;
         r.remaining -= comp_size;
 
-        if (!apply_component(e, comp_id, cr)) return false;
+        if (!apply_component(in.local, comp_id, cr)) return false;
     }
 
     return true;
 }
 
+// full snapshots are mostly entities the client has never seen. instead of
+// creating them one at a time and moving each through a table per added
+// component, new entities are grouped by (signature, parent) and every group
+// is created with one ecs_bulk_init straight in its final table. reading the
+// components afterwards only writes the storage that is already there.
+// a group needs its parent's local id, so a chunk is created one hierarchy
+// level per round
+struct Snapshot_Materializer {
+    std::vector<Incoming_Entity> incoming;
+    std::vector<uint32_t> pending; // new, parent not created yet
+    std::vector<uint32_t> ready;
+    std::vector<uint32_t> waiting;
+    std::vector<uint64_t> waiting_ids; // sorted server ids of waiting
+
+    bool materialize(Scene& scene, ByteReader& r, uint32_t entity_count, Net_Id_Map& id_map) {
+        incoming.clear();
+        pending.clear();
+
+        for (uint32_t i = 0; i < entity_count; i++) {
+            uint32_t entity_size;
+            if (!r.read(entity_size)) return false;
+            if (r.remaining < entity_size) return false;
+
+            ByteReader er(r.ptr, entity_size);
+            r.ptr       += entity_size;
+            r.remaining -= entity_size;
+
+            Incoming_Entity& in = incoming.emplace_back();
+            if (!parse_entity(er, in)) return false;
+
+            in.local = id_map.find(in.server_id);
+            if (!in.local)
+                pending.push_back(i);
+        }
+
+        create_pending(scene, id_map);
+
+        for (Incoming_Entity& in : incoming) {
+            if (!in.created && in.parent_server_id != 0) {
+                flecs::entity parent = id_map.find(in.parent_server_id);
+                if (parent)
+                    in.local.add(flecs::ChildOf, parent);
+            }
+
+            if (!apply_components(in)) return false;
+        }
+
+        return true;
+    }
+
+private:
+    // entities whose parent has a proxy, or that have no parent
+    void create_pending(Scene& scene, Net_Id_Map& id_map) {
+        // proxies always carry what Scene::create_entity gives an entity
+        const uint32_t base = 1u << net_component_index(net_id<Transform_Component>)
+                            | 1u << net_component_index(net_id<Name_Component>);
+
+        while (!pending.empty()) {
+            ready.clear();
+            waiting.clear();
+
+            for (uint32_t i : pending) {
+                const Incoming_Entity& in = incoming[i];
+                if (in.parent_server_id == 0 || id_map.contains(in.parent_server_id))
+                    ready.push_back(i);
+                else
+                    waiting.push_back(i);
+            }
+
+            // parent is not part of what we were sent, created unparented
+            // like a single entity would be. only the tops of such subtrees,
+            // their children still go under them in a later round
+            if (ready.empty()) {
+                waiting_ids.clear();
+                for (uint32_t i : waiting)
+                    waiting_ids.push_back(incoming[i].server_id);
+                std::sort(waiting_ids.begin(), waiting_ids.end());
+
+                size_t kept = 0;
+                for (uint32_t i : waiting) {
+                    if (std::binary_search(waiting_ids.begin(), waiting_ids.end(), incoming[i].parent_server_id))
+                        waiting[kept++] = i;
+                    else
+                        ready.push_back(i);
+                }
+                waiting.resize(kept);
+
+                // a parent cycle has no top, nothing else left to do
+                if (ready.empty())
+                    ready.swap(waiting);
+            }
+
+            std::sort(ready.begin(), ready.end(), [&](uint32_t a, uint32_t b) {
+                const Incoming_Entity& ea = incoming[a];
+                const Incoming_Entity& eb = incoming[b];
+                if (ea.signature != eb.signature) return ea.signature < eb.signature;
+                return ea.parent_server_id < eb.parent_server_id;
+            });
+
+            for (size_t first = 0; first < ready.size(); ) {
+                const Incoming_Entity& head = incoming[ready[first]];
+                size_t last = first + 1;
+                while (last < ready.size()
+                    && incoming[ready[last]].signature == head.signature
+                    && incoming[ready[last]].parent_server_id == head.parent_server_id)
+                    last++;
+
+                ecs_bulk_desc_t desc = {};
+                desc.count = static_cast<int32_t>(last - first);
+
+                int32_t id_count = 0;
+                uint32_t signature = head.signature | base;
+                Net_Registry::for_each([&]<typename T>(NetComponentID id) {
+                    if (signature & 1u << net_component_index(id))
+                        desc.ids[id_count++] = scene.world.id<typename Net_Apply<T>::Stored>();
+                });
+
+                flecs::entity parent = id_map.find(head.parent_server_id);
+                if (parent)
+                    desc.ids[id_count++] = ecs_pair(EcsChildOf, parent.id());
+
+                // valid until the next bulk operation
+                const ecs_entity_t* created = ecs_bulk_init(scene.world, &desc);
+                for (size_t i = first; i < last; i++) {
+                    Incoming_Entity& in = incoming[ready[i]];
+                    in.local = flecs::entity(scene.world, created[i - first]);
+                    in.created = true;
+                    id_map.insert(in.server_id, in.local);
+                }
+
+                first = last;
+            }
+
+            pending.swap(waiting);
+        }
+    }
+};
+
+static bool deserialize_entities(Scene& scene, ByteReader& r, uint32_t entity_count, Net_Id_Map& id_map) {
+    // snapshots are applied on one thread, the scratch is kept between chunks
+    static Snapshot_Materializer materializer;
+    return materializer.materialize(scene, r, entity_count, id_map);
+}
+
 // id_map: maps server entity IDs -> local entity IDs
 static bool deserialize_scene(
     Scene& scene,
     const uint8_t* data, size_t size,
-    std::unordered_map<uint64_t, flecs::entity>& id_map)
+    Net_Id_Map& id_map)
 {
     ByteReader r(data, size);
 
     uint32_t entity_count;
     if (!r.read(entity_count)) return false;
 
-    for (uint32_t i = 0; i < entity_count; i++) {
-        uint32_t entity_size;
-        if (!r.read(entity_size)) return false;
-        if (r.remaining < entity_size) return false;
+    return deserialize_entities(scene, r, entity_count, id_map);
+}
 
-        ByteReader er(r.ptr, entity_size);
-        r.ptr       += entity_size;
-        r.remaining -= entity_size;
+// one SnapshotChunk of a streamed full snapshot
+static bool deserialize_scene_chunk(
+    Scene& scene,
+    const uint8_t* data, size_t size,
+    Net_Id_Map& id_map)
+{
+    ByteReader r(data, size);
 
-        if (!deserialize_entity(scene, er, id_map)) return false;
-    }
+    Snapshot_Chunk_Header header;
+    if (!r.read(header)) return false;
 
-    return true;
+    return deserialize_entities(scene, r, header.entity_count, id_map);
 }
 
 #endif
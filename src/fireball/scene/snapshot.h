@@ -0,0 +1,621 @@
+#pragma once
+
+#include "serializer.h"
+
+#include "fireball/networking/network_protocol.h"
+
+#include <algorithm>
+#include <optional>
+#include <type_traits>
+
+// delta replication
+// the server captures the replicated state of the world once per tick into
+// a ring of snapshots. every client acks the deltas it applied and the next
+// delta it receives is encoded against its newest acked snapshot, field by
+// field. the client keeps the same ring so baseline + delta always rebuilds
+// the exact server state, even if some deltas in between were lost
+
+// in snapshot ticks, half a second at the default 128 Hz. clients whose
+// newest ack is older than that get a delta from nothing
+constexpr uint32_t SNAPSHOT_RING_SIZE = 64;
+
+struct Net_Entity_State {
+    uint64_t entity_id = 0;
+    uint64_t parent_id = 0;
+
+    Net_Registry::States components;
+
+    // server side only, used for interest management and never replicated
+    vec3 world_position = vec3(0.0f);
+    bool always_relevant = false;
+
+    // server side only, the transform as it goes on the wire. quantized once
+    // at capture instead of per client every time a delta diffs it
+    Net_Transform net_transform = {};
+
+    // server side only, the tick every component last changed at by
+    // net_component_index and the newest of those or a reparent. deltas
+    // skip whatever did not change since their baseline without diffing it
+    uint32_t component_tick[NET_COMPONENT_COUNT] = {};
+    uint32_t changed_tick = 0;
+
+    template<typename T>
+    std::optional<T>& get() { return std::get<std::optional<T>>(components); }
+
+    template<typename T>
+    const std::optional<T>& get() const { return std::get<std::optional<T>>(components); }
+};
+
+struct Net_Snapshot {
+    uint32_t tick = 0; // 0 is never a valid tick
+    std::vector<Net_Entity_State> entities; // sorted by entity_id
+};
+
+static const Net_Entity_State* find_entity(const Net_Snapshot& snapshot, uint64_t entity_id) {
+    auto it = std::lower_bound(snapshot.entities.begin(), snapshot.entities.end(), entity_id, [](const Net_Entity_State& s, uint64_t id) {
+        return s.entity_id < id;
+    });
+    return it != snapshot.entities.end() && it->entity_id == entity_id ? &*it : nullptr;
+}
+
+struct Snapshot_Ring {
+    Net_Snapshot slots[SNAPSHOT_RING_SIZE];
+
+    Net_Snapshot& slot(uint32_t tick) {
+        return slots[tick % SNAPSHOT_RING_SIZE];
+    }
+
+    const Net_Snapshot* find(uint32_t tick) const {
+        if (tick == 0) return nullptr;
+        const Net_Snapshot& s = slots[tick % SNAPSHOT_RING_SIZE];
+        return s.tick == tick ? &s : nullptr;
+    }
+};
+
+template<typename State, typename F>
+static void for_each_net_component(State& a, State& b, F&& f) {
+    Net_Registry::for_each([&]<typename T>(NetComponentID id) {
+        f(id, a.template get<T>(), b.template get<T>());
+    });
+}
+
+template<typename State, typename F>
+static void for_each_net_component(State& s, F&& f) {
+    for_each_net_component(s, s, [&](NetComponentID id, auto& c, auto&) { f(id, c); });
+}
+
+// replicated state of e as it is now, change ticks are left alone
+static void read_entity_state(flecs::entity e, Net_Entity_State& s) {
+    s.entity_id = e.id();
+    s.parent_id = e.parent() ? e.parent().id() : 0;
+
+    for_each_net_component(s, [&](NetComponentID, auto& c) {
+        using T = typename std::remove_reference_t<decltype(c)>::value_type;
+        if (const T* v = e.try_get<T>())
+            c = *v;
+        else
+            c.reset();
+    });
+
+    if (const Transform_Component* t = e.try_get<Transform_Component>()) {
+        s.world_position = vec3(t->world_transform[3]);
+        s.net_transform = quantize_transform(*t);
+    }
+    s.always_relevant = !s.get<Transform_Component>() || e.has<Always_Relevant>();
+}
+
+static void stamp_changed(Net_Entity_State& s, uint32_t tick) {
+    for (uint32_t& t : s.component_tick)
+        t = tick;
+    s.changed_tick = tick;
+}
+
+// full rescan, everything counts as changed this tick
+static void capture_snapshot(flecs::world& world, Net_Snapshot& out, uint32_t tick) {
+    out.tick = tick;
+    out.entities.clear();
+
+    world.query<const Name_Component>()
+        .each([&](Entity e, const Name_Component&) {
+            Net_Entity_State& s = out.entities.emplace_back();
+            read_entity_state(e, s);
+            stamp_changed(s, tick);
+        });
+
+    std::sort(out.entities.begin(), out.entities.end(), [](const Net_Entity_State& a, const Net_Entity_State& b) {
+        return a.entity_id < b.entity_id;
+    });
+}
+
+// a join stream rebuilt on the receiving end as the snapshot it was written
+// from, so the first delta has a baseline and is not the whole world. the
+// records of every chunk are collected into the ring slot of the manifest's
+// tick, which only becomes findable once the last chunk is in
+static void begin_stream_snapshot(Snapshot_Ring& ring, const Snapshot_Manifest& manifest) {
+    if (!manifest.tick) return;
+
+    Net_Snapshot& s = ring.slot(manifest.tick);
+    s.entities.clear();
+    s.entities.reserve(manifest.entity_count);
+
+    // nothing visible, no chunk follows
+    s.tick = manifest.chunk_count == 0 ? manifest.tick : 0;
+}
+
+static bool read_stream_chunk(Snapshot_Ring& ring, const Snapshot_Manifest& manifest, const uint8_t* data, size_t size, bool last) {
+    if (!manifest.tick) return true;
+
+    Net_Snapshot& out = ring.slot(manifest.tick);
+    ByteReader r(data, size);
+
+    Snapshot_Chunk_Header header;
+    if (!r.read(header)) return false;
+
+    for (uint32_t i = 0; i < header.entity_count; i++) {
+        uint32_t entity_size;
+        if (!r.read(entity_size)) return false;
+        if (r.remaining < entity_size) return false;
+
+        ByteReader er(r.ptr, entity_size);
+        r.ptr       += entity_size;
+        r.remaining -= entity_size;
+
+        Net_Entity_State& s = out.entities.emplace_back();
+        uint8_t component_count;
+        if (!er.read(s.entity_id))      return false;
+        if (!er.read(s.parent_id))      return false;
+        if (!er.read(component_count))  return false;
+
+        for (uint8_t c = 0; c < component_count; c++) {
+            NetComponentID comp_id;
+            uint16_t comp_size;
+            if (!er.read(comp_id))   return false;
+            if (!er.read(comp_size)) return false;
+            if (er.remaining < comp_size) return false;
+            if (net_component_index(comp_id) == NET_COMPONENT_COUNT) return false;
+
+            ByteReader cr(er.ptr, comp_size);
+            er.ptr       += comp_size;
+            er.remaining -= comp_size;
+
+            bool ok = true;
+            for_each_net_component(s, [&](NetComponentID id, auto& comp) {
+                if (id != comp_id) return;
+                comp.emplace();
+                ok = net_read(cr, *comp);
+            });
+            if (!ok) return false;
+        }
+    }
+
+    if (last) {
+        std::sort(out.entities.begin(), out.entities.end(), [](const Net_Entity_State& a, const Net_Entity_State& b) {
+            return a.entity_id < b.entity_id;
+        });
+        out.tick = manifest.tick;
+    }
+    return true;
+}
+
+//   [Delta_Header]
+//   [uint32 removed_count]
+//   [uint64 entity_id] * removed_count
+//   [uint32 changed_count]
+//   for each changed entity:
+//     [uint64 entity_id]
+//     [uint64 parent_id]
+//     [uint8  component_count]
+//     for each component:
+//       [uint8  NetComponentID]
+//       [uint8  field_mask]  (0 means the component was removed)
+//       [uint16 byte_length]
+//       [changed fields...]
+//
+// entities and removals are written in entity_id order so both ends can
+// merge against the baseline in one linear pass
+
+// restricts a snapshot to the sorted entity ids a client can see,
+// queried with ascending ids
+struct View_Cursor {
+    const std::vector<uint64_t>* view;
+    size_t i = 0;
+
+    bool contains(uint64_t id) {
+        if (!view) return true;
+        while (i < view->size() && (*view)[i] < id)
+            i++;
+        return i < view->size() && (*view)[i] == id;
+    }
+};
+
+// appended to w, a writer kept between calls keeps this from allocating.
+// the views restrict baseline and current to what the client saw at those
+// ticks, nullptr means everything
+static void serialize_delta(
+    ByteWriter& w,
+    const Net_Snapshot* baseline, const Net_Snapshot& current,
+    const std::vector<uint64_t>* baseline_view = nullptr,
+    const std::vector<uint64_t>* current_view = nullptr)
+{
+    static const Net_Snapshot empty;
+    const Net_Snapshot& base = baseline ? *baseline : empty;
+
+    w.write(Delta_Header { .tick = current.tick, .baseline_tick = base.tick });
+
+    // removed, in baseline but not in current
+    size_t removed_offset = w.data.size();
+    uint32_t removed_count = 0;
+    w.write(removed_count);
+
+    View_Cursor base_view { baseline_view };
+    View_Cursor cur_view { current_view };
+
+    size_t ci = 0;
+    for (const Net_Entity_State& b : base.entities) {
+        if (!base_view.contains(b.entity_id))
+            continue;
+
+        while (ci < current.entities.size() && current.entities[ci].entity_id < b.entity_id)
+            ci++;
+
+        bool in_current = ci < current.entities.size() && current.entities[ci].entity_id == b.entity_id;
+        if (!in_current || !cur_view.contains(b.entity_id)) {
+            w.write(b.entity_id);
+            removed_count++;
+        }
+    }
+    back_patch(w, removed_offset, removed_count);
+
+    // new or changed
+    size_t changed_offset = w.data.size();
+    uint32_t changed_count = 0;
+    w.write(changed_count);
+
+    base_view = { baseline_view };
+    cur_view = { current_view };
+
+    size_t bi = 0;
+    for (const Net_Entity_State& c : current.entities) {
+        if (!cur_view.contains(c.entity_id))
+            continue;
+
+        while (bi < base.entities.size() && base.entities[bi].entity_id < c.entity_id)
+            bi++;
+
+        // only a baseline if the client could see it back then
+        const Net_Entity_State* b = nullptr;
+        if (bi < base.entities.size() && base.entities[bi].entity_id == c.entity_id && base_view.contains(c.entity_id))
+            b = &base.entities[bi];
+
+        // untouched since the baseline, nothing to diff
+        if (b && c.changed_tick <= base.tick)
+            continue;
+
+        size_t entity_start = w.data.size();
+        w.write(c.entity_id);
+        w.write(c.parent_id);
+
+        size_t count_offset = w.data.size();
+        uint8_t component_count = 0;
+        w.write(component_count);
+
+        static const Net_Entity_State no_state;
+        for_each_net_component(b ? *b : no_state, c, [&](NetComponentID id, const auto& prev, const auto& cur) {
+            if (b && c.component_tick[net_component_index(id)] <= base.tick)
+                return;
+
+            using T = typename std::remove_cvref_t<decltype(cur)>::value_type;
+            constexpr bool quantized = std::is_same_v<T, Transform_Component>;
+
+            uint8_t mask = 0;
+            if (cur) {
+                if constexpr (quantized)
+                    mask = prev ? diff_fields(b->net_transform, c.net_transform) : NET_FIELDS_ALL;
+                else
+                    mask = prev ? diff_fields(*prev, *cur) : NET_FIELDS_ALL;
+            }
+            else if (!prev)
+                return;
+
+            // unchanged
+            if (cur && mask == 0)
+                return;
+
+            w.write(id);
+            w.write(mask);
+
+            size_t len_offset = w.data.size();
+            w.write(uint16_t(0));
+            if constexpr (quantized) {
+                if (cur)
+                    serialize_fields(w, c.net_transform, mask);
+            }
+            else if (cur)
+                serialize_fields(w, *cur, mask);
+            back_patch(w, len_offset, static_cast<uint16_t>(w.data.size() - len_offset - sizeof(uint16_t)));
+
+            component_count++;
+        });
+
+        if (b && component_count == 0 && b->parent_id == c.parent_id) {
+            w.data.resize(entity_start);
+            continue;
+        }
+
+        back_patch(w, count_offset, component_count);
+        changed_count++;
+    }
+    back_patch(w, changed_offset, changed_count);
+}
+
+// rebuilds the snapshot the server delta'd from base into out
+static bool deserialize_delta(ByteReader& r, const Net_Snapshot& base, Net_Snapshot& out) {
+    Delta_Header header;
+    if (!r.read(header)) return false;
+    if (header.baseline_tick != base.tick) return false;
+
+    uint32_t removed_count;
+    if (!r.read(removed_count)) return false;
+    if (r.remaining < size_t(removed_count) * sizeof(uint64_t)) return false;
+
+    const uint8_t* removed = r.ptr;
+    r.ptr       += removed_count * sizeof(uint64_t);
+    r.remaining -= removed_count * sizeof(uint64_t);
+
+    out.tick = header.tick;
+    out.entities.clear();
+    out.entities.reserve(base.entities.size());
+
+    size_t bi = 0;
+    uint32_t ri = 0;
+    auto copy_base_until = [&](uint64_t id) {
+        for (; bi < base.entities.size() && base.entities[bi].entity_id < id; bi++) {
+            uint64_t removed_id = 0;
+            while (ri < removed_count) {
+                memcpy(&removed_id, removed + ri * sizeof(uint64_t), sizeof(uint64_t));
+                if (removed_id >= base.entities[bi].entity_id) break;
+                ri++;
+            }
+
+            if (ri < removed_count && removed_id == base.entities[bi].entity_id)
+                continue;
+
+            out.entities.push_back(base.entities[bi]);
+        }
+    };
+
+    uint32_t changed_count;
+    if (!r.read(changed_count)) return false;
+
+    for (uint32_t i = 0; i < changed_count; i++) {
+        uint64_t entity_id, parent_id;
+        uint8_t component_count;
+        if (!r.read(entity_id))       return false;
+        if (!r.read(parent_id))       return false;
+        if (!r.read(component_count)) return false;
+
+        copy_base_until(entity_id);
+
+        Net_Entity_State& s = out.entities.emplace_back();
+        if (bi < base.entities.size() && base.entities[bi].entity_id == entity_id)
+            s = base.entities[bi++];
+
+        s.entity_id = entity_id;
+        s.parent_id = parent_id;
+
+        for (uint8_t c = 0; c < component_count; c++) {
+            NetComponentID comp_id;
+            uint8_t mask;
+            uint16_t comp_size;
+            if (!r.read(comp_id))   return false;
+            if (!r.read(mask))      return false;
+            if (!r.read(comp_size)) return false;
+            if (r.remaining < comp_size) return false;
+
+            ByteReader cr(r.ptr, comp_size);
+            r.ptr       += comp_size;
+            r.remaining -= comp_size;
+
+            bool ok = true;
+            for_each_net_component(s, [&](NetComponentID id, auto& comp) {
+                if (id != comp_id) return;
+
+                if (mask == 0) {
+                    comp.reset();
+                    return;
+                }
+
+                if (!comp) comp.emplace();
+                ok = deserialize_fields(cr, *comp, mask);
+            });
+
+            if (!ok) return false;
+        }
+    }
+
+    copy_base_until(UINT64_MAX);
+    return true;
+}
+
+#ifdef FIREBALL_CLIENT
+
+#include "interpolation.h"
+
+struct Snapshot_Receiver {
+    Snapshot_Ring ring;
+    Net_Snapshot applied; // what the ecs currently reflects
+    Interpolation_Clock clock;
+
+    // server id -> tick of an EntityDestroyed, deltas up to that tick may
+    // still carry the entity and must not bring the proxy back
+    std::unordered_map<uint64_t, uint32_t> destroyed;
+    std::vector<uint64_t> created;
+};
+
+static void destroy_proxy(Scene& scene, uint64_t server_id, Net_Id_Map& id_map) {
+    flecs::entity e = id_map.find(server_id);
+    if (!e) return;
+    if (e.is_alive())
+        scene.remove_entity(e);
+    id_map.erase(server_id);
+}
+
+// between sessions: every proxy of the last server goes and the receiver
+// starts over, so the next first delta drops what its stream did not send.
+// the clock keeps its tuning
+static void reset_session(Scene& scene, Snapshot_Receiver& receiver, Net_Id_Map& id_map) {
+    std::vector<uint64_t> proxies;
+    proxies.reserve(id_map.size());
+    id_map.for_each([&](uint64_t server_id, flecs::entity) { proxies.push_back(server_id); });
+    for (uint64_t server_id : proxies)
+        destroy_proxy(scene, server_id, id_map);
+
+    for (Net_Snapshot& s : receiver.ring.slots)
+        s = {};
+    receiver.applied = {};
+    receiver.destroyed.clear();
+    receiver.created.clear();
+
+    Interpolation_Clock clock;
+    clock.min_delay = receiver.clock.min_delay;
+    clock.max_delay = receiver.clock.max_delay;
+    clock.max_extrapolation = receiver.clock.max_extrapolation;
+    receiver.clock = clock;
+}
+
+// writes everything that differs between the applied snapshot and next into the world
+static void apply_snapshot(Scene& scene, const Net_Snapshot& next, Snapshot_Receiver& receiver, Net_Id_Map& id_map) {
+    Net_Snapshot& applied = receiver.applied;
+
+    auto fenced = [&](uint64_t server_id) {
+        auto it = receiver.destroyed.find(server_id);
+        return it != receiver.destroyed.end() && next.tick <= it->second;
+    };
+
+    // first delta, drop whatever the full snapshot created that is not part of it
+    if (applied.tick == 0) {
+        std::vector<uint64_t> stale;
+        id_map.for_each([&](uint64_t server_id, flecs::entity) {
+            if (!find_entity(next, server_id))
+                stale.push_back(server_id);
+        });
+        for (uint64_t server_id : stale)
+            destroy_proxy(scene, server_id, id_map);
+    }
+
+    // create first so parents resolve regardless of id order
+    receiver.created.clear();
+    for (const Net_Entity_State& s : next.entities) {
+        if (!id_map.contains(s.entity_id) && !fenced(s.entity_id)) {
+            id_map.insert(s.entity_id, scene.create_entity());
+            receiver.created.push_back(s.entity_id);
+        }
+    }
+
+    static const Net_Entity_State no_state;
+
+    size_t ai = 0;
+    for (const Net_Entity_State& s : next.entities) {
+        for (; ai < applied.entities.size() && applied.entities[ai].entity_id < s.entity_id; ai++)
+            destroy_proxy(scene, applied.entities[ai].entity_id, id_map);
+
+        const Net_Entity_State* prev = nullptr;
+        if (ai < applied.entities.size() && applied.entities[ai].entity_id == s.entity_id)
+            prev = &applied.entities[ai++];
+
+        Entity e = id_map.find(s.entity_id);
+        if (!e)
+            continue;
+
+        // proxy is new even if the entity was applied before, i.e. it was destroyed in between
+        if (std::binary_search(receiver.created.begin(), receiver.created.end(), s.entity_id))
+            prev = nullptr;
+
+        if (!prev || prev->parent_id != s.parent_id) {
+            e.remove(flecs::ChildOf, flecs::Wildcard);
+
+            Entity parent = id_map.find(s.parent_id);
+            if (s.parent_id != 0 && parent)
+                e.add(flecs::ChildOf, parent);
+        }
+
+        for_each_net_component(prev ? *prev : no_state, s, [&](NetComponentID, const auto& old, const auto& cur) {
+            using T = typename std::remove_cvref_t<decltype(cur)>::value_type;
+
+            // interpolated transforms are written by the Interpolation_System,
+            // predicted ones by the client itself
+            if constexpr (std::is_same_v<T, Transform_Component>) {
+                if (cur && old && (e.has<Interpolation_Component>() || e.has<Predicted_Component>()))
+                    return;
+            }
+
+            if (cur && (!old || diff_fields(*old, *cur)))
+                Net_Apply<T>::set(e, *cur);
+            else if (!cur && old)
+                Net_Apply<T>::remove(e);
+        });
+
+        // every snapshot is a sample, also when nothing moved
+        const std::optional<Transform_Component>& transform = s.get<Transform_Component>();
+        if (transform && !e.has<Predicted_Component>()) {
+            Interpolation_Component& ic = e.ensure<Interpolation_Component>();
+            ic.push(make_interpolation_sample(receiver.clock.server_time(next.tick), *transform));
+        }
+        else if (!transform && prev && prev->get<Transform_Component>()) {
+            e.remove<Interpolation_Component>();
+        }
+    }
+
+    for (; ai < applied.entities.size(); ai++)
+        destroy_proxy(scene, applied.entities[ai].entity_id, id_map);
+
+    applied.tick = next.tick;
+    applied.entities = next.entities;
+
+    std::erase_if(receiver.destroyed, [&](const auto& d) { return d.second < next.tick; });
+}
+
+// EntityDestroyed, entities that left our view or were destroyed on the server
+static bool destroy_entities(Scene& scene, const uint8_t* data, size_t size, Snapshot_Receiver& receiver, Net_Id_Map& id_map) {
+    ByteReader r(data, size);
+
+    Entity_Destroyed_Header header;
+    if (!r.read(header)) return false;
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        uint64_t server_id;
+        if (!r.read(server_id)) return false;
+
+        destroy_proxy(scene, server_id, id_map);
+        receiver.destroyed[server_id] = header.tick;
+    }
+
+    return true;
+}
+
+// returns false if the delta could not be applied, it must not be acked then
+// local_time is when it arrived, on the same clock as later render times
+static bool apply_delta(Scene& scene, const uint8_t* data, size_t size, double local_time, Snapshot_Receiver& receiver, Net_Id_Map& id_map) {
+    Delta_Header header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+
+    static const Net_Snapshot empty;
+    const Net_Snapshot* base = header.baseline_tick ? receiver.ring.find(header.baseline_tick) : &empty;
+    if (!base) return false; // baseline fell out of our ring
+
+    Net_Snapshot& next = receiver.ring.slot(header.tick);
+    if (&next == base) return false;
+
+    ByteReader r(data, size);
+    if (!deserialize_delta(r, *base, next)) {
+        next.tick = 0;
+        return false;
+    }
+
+    receiver.clock.on_snapshot(header.tick, local_time);
+    apply_snapshot(scene, next, receiver, id_map);
+    return true;
+}
+
+#endif
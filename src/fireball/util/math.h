@@ -41,3 +41,14 @@ using glm::max;
 using glm::min;
 using glm::ortho;
 using glm::eulerAngles;
+
+// Transform_Component rotations are (pitch, yaw, roll), applied yaw pitch roll
+inline quat euler_to_quat(const vec3& rotation) {
+    return glm::quat_cast(yawPitchRoll(rotation.y, rotation.x, rotation.z));
+}
+
+inline vec3 quat_to_euler(const quat& q) {
+    float yaw, pitch, roll;
+    glm::extractEulerAngleYXZ(mat4_cast(q), yaw, pitch, roll);
+    return vec3(pitch, yaw, roll);
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// fixed rate tick scheduling
+// the loop sleeps most of the way to the next deadline and spins the rest,
+// os sleeps overshoot by up to a scheduler quantum so the last stretch is
+// busy waited. deadlines advance by a fixed interval so the rate does not
+// drift, and if the loop falls behind the missed ticks are run back to back
+// up to max_catch_up before the schedule is reset
+
+class Tick_Scheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    uint32_t max_catch_up = 8;
+    // wake this early and spin. every microsecond of it is burnt each tick,
+    // 250us is 3% of a core at 128 Hz. raise it where sleeps overshoot more
+    std::chrono::microseconds spin_margin { 250 };
+
+    explicit Tick_Scheduler(uint32_t tick_rate) {
+        set_tick_rate(tick_rate);
+    }
+
+    void set_tick_rate(uint32_t tick_rate) {
+        m_tick_rate = std::max(tick_rate, 1u);
+        m_interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_tick_rate));
+        m_deadline = Clock::now();
+    }
+
+    uint32_t tick_rate() const { return m_tick_rate; }
+    float dt() const { return 1.0f / m_tick_rate; }
+    Clock::duration interval() const { return m_interval; }
+
+    // blocks until the next tick is due, returns how many fixed steps to run
+    uint32_t wait() {
+        Clock::time_point now = Clock::now();
+
+        if (now < m_deadline) {
+            if (m_deadline - now > spin_margin)
+                std::this_thread::sleep_for(m_deadline - now - spin_margin);
+
+            while (Clock::now() < m_deadline)
+                ;
+
+            now = Clock::now();
+        }
+
+        uint32_t steps = 1 + static_cast<uint32_t>((now - m_deadline) / m_interval);
+        if (steps > max_catch_up) {
+            m_dropped.fetch_add(steps - max_catch_up, std::memory_order_relaxed);
+            steps = max_catch_up;
+            m_deadline = now + m_interval;
+        }
+        else {
+            m_deadline += steps * m_interval;
+        }
+
+        return steps;
+    }
+
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    uint32_t m_tick_rate = 0;
+    Clock::duration m_interval {};
+    Clock::time_point m_deadline {};
+    std::atomic<uint64_t> m_dropped = 0; // read by the console thread
+};
+
+// per phase timings of the last Tick_Telemetry::WINDOW ticks
+// recorded by the tick thread, reported from any thread
+class Tick_Telemetry {
+public:
+    static constexpr uint32_t WINDOW = 1024;
+    static constexpr uint32_t MAX_PHASES = 8;
+
+    Tick_Telemetry(std::vector<const char*> phase_names, double budget_ms)
+        : m_names(std::move(phase_names)), m_budget_ms(budget_ms) {
+        m_names.resize(std::min<size_t>(m_names.size(), MAX_PHASES));
+    }
+
+    void set_budget(double budget_ms) {
+        std::lock_guard lock(m_mutex);
+        m_budget_ms = budget_ms;
+    }
+
+    void begin_tick() {
+        m_current = {};
+        m_tick_start = m_phase_start = Tick_Scheduler::Clock::now();
+    }
+
+    // closes the running phase and opens the next one
+    void end_phase(uint32_t phase) {
+        Tick_Scheduler::Clock::time_point now = Tick_Scheduler::Clock::now();
+        if (phase < MAX_PHASES)
+            m_current.phases[phase] += ms(now - m_phase_start);
+        m_phase_start = now;
+    }
+
+    void end_tick() {
+        m_current.total = ms(Tick_Scheduler::Clock::now() - m_tick_start);
+
+        std::lock_guard lock(m_mutex);
+        m_samples[m_count % WINDOW] = m_current;
+        m_count++;
+        if (m_current.total > m_budget_ms)
+            m_overruns++;
+    }
+
+    struct Summary {
+        uint64_t ticks;
+        uint64_t overruns;
+        double budget_ms;
+        float p50_ms, p99_ms, max_ms; // of whole ticks
+    };
+
+    Summary summary() {
+        std::vector<float> totals;
+        Summary s = {};
+        {
+            std::lock_guard lock(m_mutex);
+            s.ticks = m_count;
+            s.overruns = m_overruns;
+            s.budget_ms = m_budget_ms;
+            for (uint64_t i = 0; i < std::min<uint64_t>(m_count, WINDOW); i++)
+                totals.push_back(m_samples[i].total);
+        }
+
+        if (!totals.empty()) {
+            s.max_ms = *std::max_element(totals.begin(), totals.end());
+            s.p50_ms = percentile(totals, 0.50);
+            s.p99_ms = percentile(totals, 0.99);
+        }
+        return s;
+    }
+
+    void print(uint64_t dropped_ticks = 0) {
+        std::vector<Sample> samples;
+        uint64_t count, overruns;
+        double budget;
+        {
+            std::lock_guard lock(m_mutex);
+            count = m_count;
+            overruns = m_overruns;
+            budget = m_budget_ms;
+            samples.assign(m_samples.begin(), m_samples.begin() + std::min<uint64_t>(m_count, WINDOW));
+        }
+
+        printf("[TICK] %llu ticks, %llu overruns (budget %.2f ms), %llu dropped, last %zu:\n",
+            (unsigned long long)count, (unsigned long long)overruns, budget, (unsigned long long)dropped_ticks, samples.size());
+        if (samples.empty()) return;
+
+        std::vector<float> values(samples.size());
+        auto report = [&](const char* name, auto get) {
+            for (size_t i = 0; i < samples.size(); i++)
+                values[i] = get(samples[i]);
+            printf("  %-10s p50 %7.3f  p99 %7.3f  max %7.3f ms\n", name, percentile(values, 0.50), percentile(values, 0.99), *std::max_element(values.begin(), values.end()));
+        };
+
+        for (uint32_t p = 0; p < m_names.size(); p++)
+            report(m_names[p], [p](const Sample& s) { return s.phases[p]; });
+        report("total", [](const Sample& s) { return s.total; });
+    }
+
+private:
+    struct Sample {
+        std::array<float, MAX_PHASES> phases {};
+        float total = 0.0f;
+    };
+
+    std::vector<const char*> m_names;
+    Sample m_current;
+    Tick_Scheduler::Clock::time_point m_tick_start, m_phase_start;
+
+    std::mutex m_mutex;
+    std::array<Sample, WINDOW> m_samples {};
+    uint64_t m_count = 0;
+    uint64_t m_overruns = 0;
+    double m_budget_ms;
+
+    static float ms(Tick_Scheduler::Clock::duration d) {
+        return std::chrono::duration<float, std::milli>(d).count();
+    }
+
+    static float percentile(std::vector<float>& v, double p) {
+        size_t n = static_cast<size_t>(p * (v.size() - 1));
+        std::nth_element(v.begin(), v.begin() + n, v.end());
+        return v[n];
+    }
+};
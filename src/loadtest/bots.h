@@ -0,0 +1,328 @@
+#pragma once
+
+#include "fireball/networking/client.h"
+#include "fireball/networking/loopback.h"
+#include "fireball/scene/movement.h"
+#include "fireball/scene/snapshot.h"
+#include "fireball/util/math.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// load test bots
+// N bot clients in one process. every bot does the full join (hello,
+// streamed snapshot), sends synthetic input at a fixed rate and decodes
+// every delta into its own snapshot ring, the same reconstruction the real
+// client does minus the ecs. prints per bot receive bandwidth, snapshot
+// delay and decode time along with the server's tick stats, and fails if
+// the server's p99 tick went over its budget. run by the loadtest tool
+// against a server over udp, and by server --bots over loopback
+
+using Clock = std::chrono::steady_clock;
+
+struct Loadtest_Settings {
+    const char* ip = "127.0.0.1";
+    uint16_t port = 5678;
+    uint32_t bots = 16;
+    uint32_t input_rate = 128;    // inputs per second per bot
+    uint32_t connect_rate = 50;   // bots connected per second
+    double duration = 30.0;       // seconds after the last bot connected
+    double report_interval = 2.0;
+    bool loopback = false;        // bots run inside the server process, see server --bots
+};
+
+struct Bot {
+    Client client;
+    uint32_t index = 0;
+    bool connected = false;
+
+    // join
+    Snapshot_Manifest manifest = {};
+    bool manifest_received = false;
+    bool stream_valid = false;
+    uint32_t chunks = 0;
+    bool loaded = false;
+
+    // replication
+    Snapshot_Ring ring;
+    double tick_interval = 1.0 / 128.0;
+    double best_offset = 1e30; // lowest arrival - server time seen, the zero point of delay
+    uint32_t deltas = 0;
+    uint32_t rejected = 0;
+
+    // input
+    Input_Predictor predictor;
+    double input_accumulator = 0.0;
+    float yaw = 0.0f;
+
+    // current report window
+    uint64_t window_bytes = 0;
+    std::vector<float> decode_us;
+    std::vector<float> delay_ms;
+};
+
+static double now_seconds() {
+    static const Clock::time_point start = Clock::now();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// same ring logic as apply_delta, without writing into a world
+static bool decode_delta(Bot& bot, const uint8_t* data, size_t size) {
+    Delta_Header header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+
+    static const Net_Snapshot empty;
+    const Net_Snapshot* base = header.baseline_tick ? bot.ring.find(header.baseline_tick) : &empty;
+    if (!base) return false;
+
+    Net_Snapshot& next = bot.ring.slot(header.tick);
+    if (&next == base) return false;
+
+    ByteReader r(data, size);
+    if (!deserialize_delta(r, *base, next)) {
+        next.tick = 0;
+        return false;
+    }
+    return true;
+}
+
+static void setup_bot(Bot& bot) {
+    bot.client.on_accepted = [&bot](const Client_Accepted& info) {
+        bot.tick_interval = 1.0 / std::max(info.tick_rate, 1u);
+    };
+
+    bot.client.on_snapshot_manifest = [&bot](const Snapshot_Manifest& manifest, std::span<const uint8_t>) {
+        bot.manifest = manifest;
+        bot.manifest_received = true;
+        bot.chunks = 0;
+
+        begin_stream_snapshot(bot.ring, manifest);
+        bot.stream_valid = true;
+    };
+
+    // the stream is the baseline of the first delta, the same as on the real client
+    bot.client.on_snapshot_chunk = [&bot](const uint8_t* data, size_t size) {
+        bool last = ++bot.chunks >= bot.manifest.chunk_count;
+        bot.stream_valid = bot.stream_valid && read_stream_chunk(bot.ring, bot.manifest, data, size, last);
+        if (last)
+            bot.loaded = true;
+    };
+
+    bot.client.on_delta = [&bot](const uint8_t* data, size_t size) {
+        double arrival = now_seconds();
+
+        Clock::time_point start = Clock::now();
+        bool ok = decode_delta(bot, data, size);
+        bot.decode_us.push_back(std::chrono::duration<float, std::micro>(Clock::now() - start).count());
+
+        if (!ok) {
+            bot.rejected++;
+            return false;
+        }
+
+        Delta_Header header;
+        memcpy(&header, data, sizeof(header));
+        double offset = arrival - header.tick * bot.tick_interval;
+        bot.best_offset = std::min(bot.best_offset, offset);
+        bot.delay_ms.push_back(static_cast<float>((offset - bot.best_offset) * 1000.0));
+
+        bot.deltas++;
+        bot.loaded = true;
+        return true;
+    };
+
+    bot.client.on_input_ack = [&bot](const Input_Ack& ack) {
+        bot.predictor.reconcile(ack, static_cast<float>(bot.tick_interval));
+    };
+
+    bot.client.on_disconnected = [&bot]() {
+        printf("[LOADTEST] bot %u disconnected\n", bot.index);
+        bot.connected = false;
+    };
+}
+
+// walks in a circle, jumping now and then, different per bot
+static void send_input(Bot& bot, double dt, uint32_t input_rate) {
+    const double input_dt = 1.0 / input_rate;
+    bot.input_accumulator = std::min(bot.input_accumulator + dt, input_dt * 8);
+
+    bool recorded = false;
+    while (bot.input_accumulator >= input_dt) {
+        bot.input_accumulator -= input_dt;
+
+        bot.yaw += static_cast<float>(input_dt) * (0.5f + (bot.index % 7) * 0.1f);
+        Input_Command input {
+            .move_x = 0,
+            .move_z = 127,
+            .buttons = static_cast<uint8_t>((bot.index + static_cast<uint32_t>(bot.yaw * 10.0f)) % 97 == 0 ? Input_Jump : 0),
+            .yaw = bot.yaw,
+        };
+        bot.predictor.record(input, static_cast<float>(input_dt));
+        recorded = true;
+    }
+
+    if (recorded) {
+        Client_Input packet;
+        bot.predictor.fill_packet(packet);
+        bot.client.send_input(packet);
+    }
+}
+
+static float percentile(std::vector<float>& v, double p) {
+    if (v.empty()) return 0.0f;
+    size_t n = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + n, v.end());
+    return v[n];
+}
+
+static void report(std::vector<std::unique_ptr<Bot>>& bots, double window, const Server_Stats* stats) {
+    uint32_t connected = 0, loaded = 0;
+    uint64_t total_bytes = 0, max_bytes = 0;
+    uint32_t rejected = 0;
+    int ping_sum = 0, ping_count = 0;
+    std::vector<float> decode_us, delay_ms;
+
+    for (auto& bot : bots) {
+        if (!bot->connected) continue;
+        connected++;
+        loaded += bot->loaded;
+        rejected += bot->rejected;
+
+        uint64_t bytes = bot->client.bytes_received() - bot->window_bytes;
+        bot->window_bytes = bot->client.bytes_received();
+        total_bytes += bytes;
+        max_bytes = std::max(max_bytes, bytes);
+
+        int ping = bot->client.ping_ms();
+        if (ping >= 0) {
+            ping_sum += ping;
+            ping_count++;
+        }
+
+        decode_us.insert(decode_us.end(), bot->decode_us.begin(), bot->decode_us.end());
+        delay_ms.insert(delay_ms.end(), bot->delay_ms.begin(), bot->delay_ms.end());
+        bot->decode_us.clear();
+        bot->delay_ms.clear();
+    }
+
+    double avg_kbps = connected ? total_bytes / 1024.0 / window / connected : 0.0;
+    double max_kbps = max_bytes / 1024.0 / window;
+
+    printf("[LOADTEST] %u connected, %u loaded, %u rejected deltas\n", connected, loaded, rejected);
+    printf("  recv      avg %8.2f  max %8.2f KB/s per bot\n", avg_kbps, max_kbps);
+    printf("  ping      avg %8.2f ms\n", ping_count ? static_cast<double>(ping_sum) / ping_count : 0.0);
+    printf("  delay     p50 %8.3f  p99 %8.3f ms (snapshot arrival over best case)\n", percentile(delay_ms, 0.50), percentile(delay_ms, 0.99));
+    printf("  decode    p50 %8.3f  p99 %8.3f us\n", percentile(decode_us, 0.50), percentile(decode_us, 0.99));
+
+    if (stats) {
+        printf("  server    %u clients, %u hz, tick p50 %.3f p99 %.3f max %.3f ms (budget %.3f), %llu/%llu overruns\n",
+            stats->clients, stats->tick_rate, stats->tick_p50_ms, stats->tick_p99_ms, stats->tick_max_ms, stats->budget_ms,
+            (unsigned long long)stats->overruns, (unsigned long long)stats->ticks);
+    }
+}
+
+// 0 on pass. stops early once running goes false
+static int run_loadtest(const Loadtest_Settings& settings, const std::atomic<bool>& running) {
+    if (settings.loopback)
+        printf("[LOADTEST] %u bots in process on port %u, input at %u/s\n", settings.bots, settings.port, settings.input_rate);
+    else
+        printf("[LOADTEST] %u bots against %s:%u, input at %u/s\n", settings.bots, settings.ip, settings.port, settings.input_rate);
+
+    // bots are referenced by their callbacks, they must not move
+    std::vector<std::unique_ptr<Bot>> bots;
+    bots.reserve(settings.bots);
+
+    Server_Stats stats = {};
+    bool have_stats = false;
+
+    double last = now_seconds();
+    double last_report = last;
+    double next_connect = last;
+    double all_connected = -1.0;
+
+    while (running) {
+        double now = now_seconds();
+        double dt = now - last;
+        last = now;
+
+        while (bots.size() < settings.bots && now >= next_connect) {
+            auto bot = std::make_unique<Bot>();
+            bot->index = static_cast<uint32_t>(bots.size());
+            setup_bot(*bot);
+
+            std::string name = "bot_" + std::to_string(bot->index);
+            std::unique_ptr<Net_Transport> transport;
+            if (settings.loopback)
+                transport = std::make_unique<Loopback_Transport>();
+            bot->connected = bot->client.connect(settings.ip, settings.port, name, false, std::move(transport));
+            bots.push_back(std::move(bot));
+
+            next_connect += 1.0 / settings.connect_rate;
+            if (bots.size() == settings.bots)
+                all_connected = now;
+        }
+
+        for (auto& bot : bots) {
+            if (!bot->connected) continue;
+
+            bot->client.tick();
+            if (bot->loaded)
+                send_input(*bot, dt, settings.input_rate);
+        }
+
+        if (!bots.empty() && bots[0]->connected && !bots[0]->client.on_server_stats) {
+            bots[0]->client.on_server_stats = [&](const Server_Stats& s) {
+                stats = s;
+                have_stats = true;
+            };
+        }
+
+        if (now - last_report >= settings.report_interval) {
+            if (!bots.empty() && bots[0]->connected)
+                bots[0]->client.request_stats();
+
+            report(bots, now - last_report, have_stats ? &stats : nullptr);
+            last_report = now;
+        }
+
+        if (all_connected >= 0.0 && now - all_connected >= settings.duration)
+            break;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // last stats before judging, the reply races the disconnect otherwise
+    if (!bots.empty() && bots[0]->connected) {
+        have_stats = false;
+        bots[0]->client.request_stats();
+        for (double until = now_seconds() + 1.0; !have_stats && now_seconds() < until; ) {
+            bots[0]->client.tick();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    for (auto& bot : bots) {
+        if (bot->connected)
+            bot->client.disconnect();
+    }
+
+    if (!have_stats) {
+        printf("[LOADTEST] FAIL, no server stats received\n");
+        return 1;
+    }
+
+    bool pass = stats.tick_p99_ms <= stats.budget_ms;
+    printf("[LOADTEST] %s, %u bots, server tick p99 %.3f ms of %.3f ms budget\n",
+        pass ? "PASS" : "FAIL", settings.bots, stats.tick_p99_ms, stats.budget_ms);
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#include "bots.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// headless load test
+// spins up N bot clients in one process against a running server, see bots.h
+
+static void print_usage() {
+    printf("loadtest [--ip 127.0.0.1] [--port 5678] [--bots 16] [--input-rate 128] [--connect-rate 50] [--duration 30] [--report 2]\n");
+}
+
+int main(int argc, char** argv) {
+    Loadtest_Settings settings;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--ip") == 0 && has_value)                settings.ip = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && has_value)         settings.port = static_cast<uint16_t>(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--bots") == 0 && has_value)         settings.bots = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+        else if (strcmp(argv[i], "--input-rate") == 0 && has_value)   settings.input_rate = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+        else if (strcmp(argv[i], "--connect-rate") == 0 && has_value) settings.connect_rate = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+        else if (strcmp(argv[i], "--duration") == 0 && has_value)     settings.duration = atof(argv[++i]);
+        else if (strcmp(argv[i], "--report") == 0 && has_value)       settings.report_interval = atof(argv[++i]);
+        else {
+            print_usage();
+            return 2;
+        }
+    }
+
+    std::atomic<bool> running = true;
+    return run_loadtest(settings, running);
+}
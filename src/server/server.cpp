@@ -1,38 +1,124 @@
+#include "fireball/asset/model_manager.h"
+#include "fireball/core/jobs.h"
 #include "fireball/core/physics.h"
+#include "fireball/networking/loopback.h"
 #include "fireball/networking/server.h"
+#include "fireball/scene/asset_manifest.h"
 #include "fireball/scene/components.h"
+#include "fireball/scene/interest.h"
+#include "fireball/scene/movement.h"
+#include "fireball/scene/replication.h"
 #include "fireball/scene/serializer.h"
 #include "fireball/scene/scene.h"
+#include "fireball/scene/snapshot.h"
 #include "fireball/util/math.h"
+#include "fireball/util/tick.h"
 #include "fireball/util/time.h"
+#include "loadtest/bots.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <thread>
 
-bool running = true;
+std::atomic<bool> running = true;
 
 struct Player {
     HSteamNetConnection conn;
     std::string name;
+    Entity entity;
+    Movement_State movement;
+    uint32_t last_input_tick = 0; // newest input simulated
 };
 
 std::unordered_map<HSteamNetConnection, Player> g_players;
 
-int main() {
+enum Tick_Phase : uint32_t {
+	Phase_Network,
+	Phase_Physics,
+	Phase_Scene,
+	Phase_Snapshot,
+};
+
+int main(int argc, char** argv) {
     printf("fireball server starting\n");
 
 	Server server;
+	bool net_thread = false;
+	int spin_us = -1;
+	uint32_t bots = 0; // in process over loopback instead of listening on udp
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--tickrate") == 0 && i + 1 < argc)
+			server.tick_rate = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+		else if (strcmp(argv[i], "--net-thread") == 0)
+			net_thread = true;
+		else if (strcmp(argv[i], "--spin-us") == 0 && i + 1 < argc)
+			spin_us = std::max(atoi(argv[++i]), 0);
+		else if (strcmp(argv[i], "--bots") == 0 && i + 1 < argc)
+			bots = static_cast<uint32_t>(std::max(atoi(argv[++i]), 0));
+	}
+
+	Tick_Scheduler scheduler(server.tick_rate);
+	if (spin_us >= 0)
+		scheduler.spin_margin = std::chrono::microseconds(spin_us);
+	Tick_Telemetry telemetry({ "network", "physics", "scene", "snapshot" }, 1000.0 / server.tick_rate);
+	const float dt = scheduler.dt();
+
+	Jobs::init();
 	Physics::init();
+	Physics::set_fixed_step(dt, 1, false); // the tick scheduler already runs fixed steps
+	Model_Manager::init("../resources/models/", true); // only read for asset manifests, no geometry, so no Mesh bodies
 	Scene scene(nullptr);
 
+	Snapshot_Ring snapshots;
+	Replication_Log replication(scene.world);
+	Snapshot_Writer snapshot_writer(scene.world); // full snapshots for joining clients
+	Asset_Catalog asset_catalog;
+	// scanned in the background as models are set, joins only read the catalog
+	scene.world.observer<const Server_Model_Component>("Asset_Catalog_Request").event(flecs::OnSet)
+		.each([&](const Server_Model_Component& m) { asset_catalog.request(m.model_name); });
+	uint32_t snapshot_tick = 0;
+	Interest_Manager interest;
+	Relevant_Set full_view;
+	std::vector<uint64_t> left;
+	ByteWriter delta_writer; // reused, encoding a delta does not allocate once warm
+	ByteWriter destroyed_writer;
+
+	// clients that see the same entities now and at their baseline get the
+	// same bytes, encoded once per tick. views are compared by content,
+	// players standing together usually have equal ones
+	struct Shared_Delta {
+		uint32_t baseline_tick;
+		const Relevant_Set* baseline_view; // nullptr without baseline
+		const Relevant_Set* view;
+		Net_Buffer* buf; // holds a ref until the broadcast is done
+	};
+	std::vector<Shared_Delta> shared_deltas;
+
+	// what a join stream was written from, the first baseline of that client.
+	// kept aside since streaming a big world can take longer than the ring holds
+	struct Join_Baseline {
+		Net_Snapshot snapshot; // only what the client was sent
+		Relevant_Set view;
+		uint32_t first_use = 0; // tick of the first delta against it
+	};
+	std::unordered_map<HSteamNetConnection, Join_Baseline> join_baselines;
+	auto same_view = [](const Relevant_Set* a, const Relevant_Set* b) {
+		return a == b || (a && b && *a == *b);
+	};
+
 	server.on_client_joined = [&](HSteamNetConnection conn, const std::string& name) {
-        g_players[conn] = { conn, name };
+        Entity player = scene.create_entity("player " + name);
+        player.add<Always_Relevant>();
+        g_players[conn] = { conn, name, player };
         printf("[SERVER] '%s' joined (%zu players online)\n", name.c_str(), g_players.size());
 
         // TODO:serialize scene entity list into a snapshot buffer and send via:
-        // server.send_to(conn, { Net_Msg::FullSnapshot, <scene_buffer> });
+        // server.send_to(conn, Net_Msg::FullSnapshot, <scene_buffer>);
     };
 
     server.on_client_left = [&](HSteamNetConnection conn) {
@@ -40,12 +126,108 @@ int main() {
         if (it != g_players.end()) {
             printf("[SERVER] '%s' left (%zu players remaining)\n",
                    it->second.name.c_str(), g_players.size() - 1);
+            scene.remove_entity(it->second.entity);
             g_players.erase(it);
         }
+        interest.remove_client(conn);
+        join_baselines.erase(conn);
     };
 
-	server.on_full_snapshot = [&]() {
-		return serialize_scene(scene.world);
+	server.on_stats_request = [&]() {
+		Tick_Telemetry::Summary s = telemetry.summary();
+		return Server_Stats {
+			.tick_rate = server.tick_rate,
+			.clients = static_cast<uint32_t>(server.client_count()),
+			.ticks = s.ticks,
+			.overruns = s.overruns,
+			.tick_p50_ms = s.p50_ms,
+			.tick_p99_ms = s.p99_ms,
+			.tick_max_ms = s.max_ms,
+			.budget_ms = static_cast<float>(s.budget_ms),
+		};
+	};
+
+	server.on_full_snapshot = [&](const ClientState& client) {
+		vec3 viewpoint(client.viewpoint[0], client.viewpoint[1], client.viewpoint[2]);
+		const Relevant_Set* view = nullptr;
+		if (interest.built()) {
+			interest.compute_view(viewpoint, full_view);
+			view = &full_view;
+		}
+
+		Snapshot_Stream stream = serialize_scene_chunked(snapshot_writer, view, server.snapshot_chunk_size);
+		stream.assets = serialize_asset_manifest(scene.world, view, viewpoint, asset_catalog);
+
+		// the steps of this tick have not run yet, the world is what the last capture holds
+		const Net_Snapshot* current = snapshots.find(snapshot_tick);
+		if (current && view) {
+			Join_Baseline& join = join_baselines[client.conn];
+			join.view = *view;
+			join.snapshot.tick = snapshot_tick;
+			join.snapshot.entities.clear();
+
+			View_Cursor cursor { view };
+			for (const Net_Entity_State& s : current->entities) {
+				if (cursor.contains(s.entity_id))
+					join.snapshot.entities.push_back(s);
+			}
+			stream.manifest.tick = snapshot_tick;
+		}
+		return stream;
+	};
+
+	server.on_delta_update = [&](const ClientState& client) {
+		vec3 viewpoint(client.viewpoint[0], client.viewpoint[1], client.viewpoint[2]);
+		const Relevant_Set& view = interest.update_client(client.conn, snapshot_tick, viewpoint, left);
+
+		// reliable, goes out in the same batch ahead of the delta
+		if (!left.empty()) {
+			destroyed_writer.data.clear();
+			destroyed_writer.write(Entity_Destroyed_Header { snapshot_tick, static_cast<uint32_t>(left.size()) });
+			for (uint64_t id : left)
+				destroyed_writer.write(id);
+			server.queue_to(client.conn, Net_Msg::EntityDestroyed, destroyed_writer.data);
+		}
+
+		// without the view the client had at its baseline we can not tell what it has, start over
+		const Relevant_Set* baseline_view = interest.view(client.conn, client.last_acked_tick);
+		const Net_Snapshot* baseline = baseline_view ? snapshots.find(client.last_acked_tick) : nullptr;
+
+		// until the first ack the baseline is what the join stream held. a
+		// client that could not rebuild it never acks, it gets a full delta
+		// once the ring's worth of ticks went by
+		auto join = join_baselines.find(client.conn);
+		if (join != join_baselines.end()) {
+			Join_Baseline& jb = join->second;
+			if (!jb.first_use)
+				jb.first_use = snapshot_tick;
+
+			if (jb.snapshot.tick == client.last_acked_tick && snapshot_tick - jb.first_use < SNAPSHOT_RING_SIZE) {
+				baseline = &jb.snapshot;
+				baseline_view = &jb.view;
+			}
+			else {
+				join_baselines.erase(join);
+			}
+		}
+		if (!baseline)
+			baseline_view = nullptr;
+		uint32_t baseline_tick = baseline ? baseline->tick : 0;
+
+		for (const Shared_Delta& d : shared_deltas) {
+			if (d.baseline_tick == baseline_tick && same_view(d.baseline_view, baseline_view) && same_view(d.view, &view)) {
+				Net_Buffer_Pool::add_ref(d.buf);
+				return d.buf;
+			}
+		}
+
+		delta_writer.data.clear();
+		serialize_delta(delta_writer, baseline, snapshots.slot(snapshot_tick), baseline_view, &view);
+
+		Net_Buffer* buf = frame_packet(Net_Msg::DeltaUpdate, delta_writer.data);
+		shared_deltas.push_back({ baseline_tick, baseline_view, &view, buf });
+		Net_Buffer_Pool::add_ref(buf);
+		return buf;
 	};
 
 	// Entity e2 = scene.create_entity("plane");
@@ -77,6 +259,7 @@ int main() {
 	Transform_Component& tc = drag.get_mut<Transform_Component>();
 	tc.position = vec3(15, 0, 0);
 	tc.dirty = true;
+	drag.modified<Transform_Component>();
 	
 	// Entity car = scene.create_entity("911");
 	// car.set<Server_Model_Component>({ "911/scene.gltf" });
@@ -101,13 +284,9 @@ int main() {
 	// Physics_Handle ph = Physics::add_object(box);
 	// e.set<Physics_Component>({ ph, box });
 
-    double dt = 0.0;
-    double fps_timer = 0.0;
-    uint32_t fps_frames = 0;
-
 	Physics::optimize_broad_phase();
 
-	std::thread console_thread([]() {
+	std::thread console_thread([&]() {
 		std::string input;
 
 		while (running) {
@@ -118,51 +297,118 @@ int main() {
 				running = false;
 				break;
 			}
+			else if (input == "stats") {
+				telemetry.print(scheduler.dropped());
+			}
 		}
 	});
 
 	short port = 5678;
-	server.start(port);
+	if (bots == 0)
+		server.start(port, net_thread);
+	else
+		server.start(port, net_thread, std::make_unique<Loopback_Transport>());
 	
-    Time last_frame = high_resolution_clock::now();
+	printf("[SERVER] ticking at %u/s, type 'stats' for tick timings\n", server.tick_rate);
+
+	// the load test without the udp stack, gns is never initialized. the
+	// server shuts down with the bots' verdict once they are done
+	int bots_result = 0;
+	std::thread bots_thread;
+	if (bots > 0) {
+		bots_thread = std::thread([&]() {
+			Loadtest_Settings settings;
+			settings.port = static_cast<uint16_t>(port);
+			settings.bots = bots;
+			settings.loopback = true;
+
+			bots_result = run_loadtest(settings, running);
+			running = false;
+		});
+	}
+
     while (running) {
-		Time now = high_resolution_clock::now();
-		dt = duration<double>(now - last_frame).count();
-		last_frame = now;
+		// sleeps until the next tick, more than one step if we fell behind
+		uint32_t steps = scheduler.wait();
+
+		telemetry.begin_tick();
+		// what the network phase changes belongs to the first step
+		replication.begin_tick(snapshot_tick + 1);
 
-		fps_frames++;
-		fps_timer += dt;
+		server.tick();
+		telemetry.end_phase(Phase_Network);
+
+		// every step is a tick of its own, the client clock counts them
+		for (uint32_t i = 0; i < steps; i++) {
+			if (i > 0)
+				replication.begin_tick(snapshot_tick + 1 + i);
+
+			// one queued input per player per step
+			for (auto& [conn, player] : g_players) {
+				Input_Command input;
+				if (!server.pop_input(conn, input)) continue;
+
+				simulate_movement(player.movement, input, dt);
+				player.last_input_tick = input.tick;
+
+				Transform_Component& t = player.entity.get_mut<Transform_Component>();
+				t.position = player.movement.position;
+				t.rotation = movement_rotation(player.movement);
+				t.dirty = true;
+				player.entity.modified<Transform_Component>();
+			}
+			telemetry.end_phase(Phase_Network);
 
-		if (fps_timer >= 0.5) {
-			double fps = fps_frames / fps_timer;
-			double frame_ms = 1000.0 / fps;
-			fps_timer = 0.0;
-			fps_frames = 0;
+			Physics::step(dt);
+			telemetry.end_phase(Phase_Physics);
 
-			// printf("[SERVER] %.1f FPS | %.2f ms\n", fps, frame_ms);
+			scene.update(dt);
+			telemetry.end_phase(Phase_Scene);
 		}
 
-		// int state = static_cast<int>(game_state);
-		// if (ImGui::SliderInt("Game state", &state, 0, static_cast<int>(Game_State::NUM_GAME_STATE) - 1)) {
-		// 	game_state = static_cast<Game_State>(state);
-		// }
+		// one snapshot per wakeup, catch up steps are not sent individually
+		snapshot_tick += steps;
+		interest.build(replication.capture(scene.world, snapshots, snapshot_tick));
+		server.broadcast_delta();
+
+		for (const Shared_Delta& d : shared_deltas)
+			Net_Buffer_Pool::release(d.buf);
+		shared_deltas.clear();
+
+		for (auto& [conn, player] : g_players) {
+			if (!player.last_input_tick) continue;
+
+			Input_Ack ack {
+				.input_tick = player.last_input_tick,
+				.entity_id = player.entity.id(),
+				.position = { player.movement.position.x, player.movement.position.y, player.movement.position.z },
+				.velocity = { player.movement.velocity.x, player.movement.velocity.y, player.movement.velocity.z },
+			};
+			server.send_struct(conn, Net_Msg::InputAck, ack, k_nSteamNetworkingSend_UnreliableNoNagle);
+		}
+		telemetry.end_phase(Phase_Snapshot);
 
-		// get network 
-		Physics::update();
-		scene.update(dt);
-		server.tick();
-		// send network data
+		telemetry.end_tick();
 	}
 
 	printf("[SERVER] Shutting down...\n");
 
+	// the bots leave before the server closes their connections
+	if (bots_thread.joinable())
+		bots_thread.join();
+
 	server.stop();
 	// Physics::shutdown();
 
-	if (console_thread.joinable())
+	// still blocked reading stdin when the bots ended the run
+	if (bots > 0)
+		console_thread.detach();
+	else if (console_thread.joinable())
 		console_thread.join();
 
+	Jobs::shutdown();
+
 	printf("[SERVER] Shutdown\n");
 
-	return 0;
+	return bots_result;
 }